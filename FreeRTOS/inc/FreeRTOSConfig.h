@@ -45,7 +45,7 @@
 
 //#define configFRTOS_MEMORY_SCHEME   4
 #define configUSE_PREEMPTION		1
-#define configUSE_IDLE_HOOK			0
+#define configUSE_IDLE_HOOK			1
 #define configMAX_PRIORITIES		( 8 )
 #define configUSE_TICK_HOOK			0
 #define configCPU_CLOCK_HZ			( (uint32_t) SystemCoreClock )
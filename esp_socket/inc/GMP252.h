@@ -9,13 +9,18 @@
 #define GMP252_H_
 
 #include "ModbusMaster.h"
-#include "ModbusRegister.h"
+#include "ModbusRegisterSet.h"
 
 class GMP252 {
+public:
+    // register map
+    struct Co2 : ModbusReg<256> { static const char *unit() { return "ppm"; } };
+    struct Status : ModbusReg<2048> {}; // 0 = ok
+
 private:
     ModbusMaster co2Node;
-    ModbusRegister CO2;
-    ModbusRegister co2Status;
+    ModbusRegisterSet<Co2> CO2;
+    ModbusRegisterSet<Status> co2Status;
 
 public:
     GMP252 (uint8_t nodeAddress = 240);
@@ -3,17 +3,24 @@
 #define HMP60_H_
 
 #include "ModbusMaster.h"
-#include "ModbusRegister.h"
+#include "ModbusRegisterSet.h"
 
 class HMP60 {
+public:
+    // register map
+    struct Humidity : ModbusReg<256, ModbusField::int16, 10> { static const char *unit() { return "%RH"; } };
+    struct Temperature : ModbusReg<257, ModbusField::int16, 10> { static const char *unit() { return "C"; } };
+    struct Status : ModbusReg<512> {}; // 1 = ok
+
 private:
     ModbusMaster humTempNode;
-    ModbusRegister HUM;
-    ModbusRegister TEMP;
-    ModbusRegister humTempStatus;
+    ModbusRegisterSet<Humidity, Temperature> humTemp; // read together in one transaction
+    ModbusRegisterSet<Status> humTempStatus;
+    bool valid; // set when the last read() succeeded
 
 public:
     HMP60(uint8_t nodeAddress = 241);
+    bool read(); // refresh humidity and temperature in one transaction
     int getTemperature();
     int getHumidity();
     int getStatus();
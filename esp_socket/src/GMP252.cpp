@@ -9,8 +9,8 @@
 
 GMP252::GMP252(uint8_t nodeAddress)
     : co2Node(nodeAddress),
-	  CO2(&co2Node, 256, true),
-      co2Status(&co2Node, 2048, true)
+	  CO2(&co2Node),
+      co2Status(&co2Node)
 {
 	co2Node.begin(9600);
 }
@@ -19,11 +19,17 @@ int GMP252::get_co2() {
 	if(getStatus() == 0)
 	{
 		vTaskDelay(5);
-		return CO2.read();
+		if(CO2.read())
+		{
+			return CO2.get<Co2>();
+		}
 	}
     return -1;
 }
 int GMP252::getStatus() {
-
-    return co2Status.read();
+	if(!co2Status.read())
+	{
+		return -1;
+	}
+    return co2Status.get<Status>();
 }
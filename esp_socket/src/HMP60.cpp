@@ -3,37 +3,45 @@
 
 HMP60::HMP60(uint8_t nodeAddress)
     : humTempNode(nodeAddress),
-      HUM(&humTempNode, 256, true),
-      TEMP(&humTempNode, 257, true),
-      humTempStatus(&humTempNode, 512, true)
+      humTemp(&humTempNode),
+      humTempStatus(&humTempNode),
+      valid(false)
 {
     humTempNode.begin(9600);
 }
 
-int HMP60::getTemperature() {
+bool HMP60::read() {
+	valid = false;
 	vTaskDelay(5);
 	if(getStatus() == -1)
 	{
-		return -1;
+		return false;
 	}
 	vTaskDelay(5);
-    return TEMP.read() / 10;
+	valid = humTemp.read();
+	return valid;
+}
+
+// getters return values from the snapshot taken by the last read()
+int HMP60::getTemperature() {
+	if(!valid)
+	{
+		return -1;
+	}
+    return (int)humTemp.get<Temperature>();
 }
 
 int HMP60::getHumidity() {
-	vTaskDelay(5);
-	if(getStatus() == -1)
+	if(!valid)
 	{
 		return -1;
 	}
-	vTaskDelay(5);
-    return HUM.read() / 10;
+    return (int)humTemp.get<Humidity>();
 }
 int HMP60::getStatus() {
-	int status = humTempStatus.read();
-	if(status != 1)
+	if(!humTempStatus.read() || humTempStatus.get<Status>() != 1)
 	{
 		return -1;
 	}
-    return status;
+    return 1;
 }
@@ -7,6 +7,7 @@
 #endif
 #include <cr_section_macros.h>
 #include "LpcUart.h"
+#include "DebugLog.h"
 
 // FreeRTOS API related
 #include "FreeRTOS.h"
@@ -18,6 +19,10 @@
 // Setup MODBUS Sensors
 #include "DigitalIoPin.h"
 #include "ModbusRegister.h"
+#include "ModbusBus.h"
+#include "ModbusStats.h"
+#include "ModbusCrc.h"
+#include "mqtt_demo/ModbusStatsPublisher.h"
 #include "GMP252.h"
 #include "HMP60.h"
 
@@ -222,13 +227,32 @@ void inputHandler(void *pvParameters) {
 	}
 }
 
+// sensors and the measurement taken from them in the Modbus bus task
+struct SensorRead {
+	GMP252 *co2Sensor;
+	HMP60 *humTempSensor;
+	Measurement measurement;
+};
+
+static void readSensors(void *arg) {
+	SensorRead *r = static_cast<SensorRead*>(arg);
+
+	r->measurement.co2 = r->co2Sensor->get_co2();
+	r->humTempSensor->read(); // humidity and temperature come from the same transaction
+	r->measurement.temperature = r->humTempSensor->getTemperature();
+	r->measurement.humidity = r->humTempSensor->getHumidity();
+}
+
 void periphHandler(void *pvParameters) {
+	// all Modbus transactions are executed by the bus task
+	ModbusBus *bus = static_cast<ModbusBus*>(pvParameters);
 
 	// Modbus sensors are encapsulated and use proper delays for real hardware
 	GMP252 co2Sensor;
 	vTaskDelay(1);
 	HMP60 humTempSensor;
 	vTaskDelay(1);
+	SensorRead sensors = { &co2Sensor, &humTempSensor, { 0, 0, 0 } };
 
 	// The relay is used for binary control of the valve
 	// Opened for 1 second at a time due to the small size of the test system
@@ -245,7 +269,13 @@ void periphHandler(void *pvParameters) {
 	int co2Difference = 0;
 	int threshold = -30; // co2 should be more than 30 ppm under the target to warrant release
 
-	char buffer[150]; // one large buffer to include debug print data
+	// debug print data, formatted by the log task
+	static const char *status = "\r\nCO2 level (ppm): %d \r\n"
+			"Relative Humidity: %d %% \r\n"
+			"Temperature: %d C \r\n"
+			"Valve opening percentage: %.2f %% \r\n"
+			"CO2 set point (ppm): %d\r\n";
+	char stats[256]; // Modbus statistics, one line per sensor
 
 	float valveCounter = 0; // incremented by 1000 ticks/ms each time the valve is opened
 	float valveOverTime = 0; // the percentage valveCounter is of the task total tick counts
@@ -253,12 +283,23 @@ void periphHandler(void *pvParameters) {
 	while (true) {
 		// Read the sensors and group the data by using the Measurement structure
 		// Measurement is used by the displayHandler task
-		co2 = co2Sensor.get_co2();
-		temperature = humTempSensor.getTemperature();
-		humidity = humTempSensor.getHumidity();
-
-		Measurement currentMeasurement = { co2, temperature, humidity };
-		xQueueSend(dataQueue, &currentMeasurement, portMAX_DELAY);
+		bus->run(readSensors, &sensors);
+		co2 = sensors.measurement.co2;
+		temperature = sensors.measurement.temperature;
+		humidity = sensors.measurement.humidity;
+
+		xQueueSend(dataQueue, &sensors.measurement, portMAX_DELAY);
+
+		// Modbus transaction statistics to spot failing sensors and wiring
+		ModbusStats::format(stats, sizeof(stats));
+		DebugLog::text(stats);
+		LpcUartStats line = SerialPort::defaultPort()->stats();
+		DebugLog::log("bus: framing %lu parity %lu noise %lu overrun %lu break %lu\r\n",
+				line.framing, line.parity, line.noise, line.overrun, line.breaks);
+		// lock-free ring performance: interrupt cost per character and receive interrupt to task latency
+		DebugLog::log("bus: isr %lu cycles/char, wake avg %lu max %lu cycles\r\n",
+				line.isr_chars ? line.isr_cycles / line.isr_chars : 0UL,
+				line.wake_count ? line.wake_sum / line.wake_count : 0UL, line.wake_max);
 
 		if (true) {
 
@@ -277,27 +318,13 @@ void periphHandler(void *pvParameters) {
 
 				valveOverTime = (valveCounter / xTaskGetTickCount()) * 100;
 
-				snprintf(buffer, sizeof(buffer), "\r\nCO2 level (ppm): %d \r\n"
-						"Relative Humidity: %d %% \r\n"
-						"Temperature: %d C \r\n"
-						"Valve opening percentage: %.2f %% \r\n"
-						"CO2 set point (ppm): %d\r\n", co2, humidity,
-						temperature, valveOverTime, co2Target);
-
-				dbgu->write(buffer);
+				DebugLog::log(status, co2, humidity, temperature, valveOverTime, co2Target);
 
 				vTaskDelay(configTICK_RATE_HZ * 29);
 			} else {
 				valveOverTime = (valveCounter / xTaskGetTickCount()) * 100;
 
-				snprintf(buffer, sizeof(buffer), "\r\nCO2 level (ppm): %d \r\n"
-						"Relative Humidity: %d %% \r\n"
-						"Temperature: %d C \r\n"
-						"Valve opening percentage: %.2f %% \r\n"
-						"CO2 set point (ppm): %d\r\n", co2, humidity,
-						temperature, valveOverTime, co2Target);
-
-				dbgu->write(buffer);
+				DebugLog::log(status, co2, humidity, temperature, valveOverTime, co2Target);
 				vTaskDelay(configTICK_RATE_HZ * 30);
 			}
 
@@ -316,11 +343,25 @@ int main(void) {
 	LpcPinMap none = { .port = -1, .pin = -1 }; // unused pin has negative values in it
 	LpcPinMap txpin = { .port = 0, .pin = 18 }; // transmit pin that goes to debugger's UART->USB converter
 	LpcPinMap rxpin = { .port = 0, .pin = 13 }; // receive pin that goes to debugger's UART->USB converter
+	// debug port receives next to nothing but the status lines need room in the transmit buffer
+	static uint8_t dbg_rx[16];
+	static uint8_t dbg_tx[256];
 	LpcUartConfig cfg = { .pUART = LPC_USART0, .speed = 115200, .data =
 	UART_CFG_DATALEN_8 | UART_CFG_PARITY_NONE | UART_CFG_STOPLEN_1, .rs485 =
-			false, .tx = txpin, .rx = rxpin, .rts = none, .cts = none };
+			false, .tx = txpin, .rx = rxpin, .rts = none, .cts = none,
+			.dma_tx = false, .dma_rx = false,
+			.rx_buffer = dbg_rx, .rx_size = sizeof(dbg_rx), .tx_buffer = dbg_tx, .tx_size = sizeof(dbg_tx) };
 	dbgu = new LpcUart(cfg);
 	dbgu->write("Debug UART ok\r\n");
+	DebugLog::begin(dbgu, tskIDLE_PRIORITY);
+
+#if MODBUS_CRC_TEST
+	// test build: CRC backend equivalence and speed on this part
+	char crcBench[96];
+	DebugLog::text(ModbusCrc::selfTest() ? "crc self test ok\r\n" : "crc self test FAILED\r\n");
+	ModbusCrc::benchmark(crcBench, sizeof(crcBench));
+	DebugLog::text(crcBench);
+#endif
 
 	// LCD initialized here; two tasks need to use it
 	DigitalIoPin *rs = new DigitalIoPin(0, 29, DigitalIoPin::output);
@@ -338,6 +379,9 @@ int main(void) {
 	controlQueue = xQueueCreate(5, sizeof(int)); // co2 setpoint
 	uiMutex = xSemaphoreCreateMutex(); // controls print access to the lcd
 
+	// Owns the RS-485 port and executes all Modbus transactions
+	ModbusBus *modbus = new ModbusBus("modbus", tskIDLE_PRIORITY + 2);
+
 	// Display sensor readings on the lcd
 	xTaskCreate(displayHandler, "display", configMINIMAL_STACK_SIZE * 3, lcd,
 	tskIDLE_PRIORITY + 1, NULL);
@@ -347,10 +391,13 @@ int main(void) {
 	tskIDLE_PRIORITY + 1, NULL);
 
 	// Read the sensors and control the valve
-	xTaskCreate(periphHandler, "peripherals", configMINIMAL_STACK_SIZE * 5,
-	NULL,
+	xTaskCreate(periphHandler, "peripherals", configMINIMAL_STACK_SIZE * 6,
+	modbus,
 	tskIDLE_PRIORITY + 1, NULL);
 
+	// Publish the Modbus statistics as JSON every minute
+	vStartModbusStatsPublisher(60000);
+
 	/* Start the scheduler */
 	vTaskStartScheduler();
 
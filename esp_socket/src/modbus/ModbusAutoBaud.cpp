@@ -0,0 +1,94 @@
+/*
+ * ModbusAutoBaud.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include "ModbusAutoBaud.h"
+
+ModbusAutoBaud::ModbusAutoBaud(const uint32_t *rates, int count_)
+	: r(rates), rateCount(count_), count(0) {
+}
+
+ModbusAutoBaud::~ModbusAutoBaud() {
+}
+
+bool ModbusAutoBaud::add(ModbusMaster *node, uint16_t probeRegister, SetRate setRate, void *arg) {
+	if(count >= MaxDevices) return false;
+
+	devices[count].node = node;
+	devices[count].probeRegister = probeRegister;
+	devices[count].setRate = setRate;
+	devices[count].arg = arg;
+	++count;
+	return true;
+}
+
+/* Any answer, also an exception, shows that the slave understands the line speed.
+ * A single attempt with a short timeout: retries would only multiply the cost of a wrong speed */
+bool ModbusAutoBaud::probe(const Device &d) {
+	if(d.node->startReadHoldingRegisters(d.probeRegister, 1) != d.node->ku8MBSuccess) return false;
+	uint8_t result = d.node->wait(ProbeTimeout);
+	return result != d.node->ku8MBResponseTimedOut && result != d.node->ku8MBInvalidCRC &&
+			result != d.node->ku8MBInvalidFrame && result != d.node->ku8MBInvalidSlaveID &&
+			result != d.node->ku8MBSlaveOffline;
+}
+
+bool ModbusAutoBaud::probeAll() {
+	for(int i = 0; i < count; ++i) {
+		if(!probe(devices[i])) return false;
+	}
+	return true;
+}
+
+/* The serial port is shared, but every master keeps its own timing state */
+void ModbusAutoBaud::setBus(uint32_t bps) {
+	for(int i = 0; i < count; ++i) {
+		devices[i].node->begin(bps);
+	}
+}
+
+uint32_t ModbusAutoBaud::find(ModbusMaster *node, uint16_t probeRegister) {
+	Device d = { node, probeRegister, nullptr, nullptr };
+	uint32_t current = node->baudRate();
+
+	if(probe(d)) return current;
+	for(int i = 0; i < rateCount; ++i) {
+		if(r[i] == current) continue;
+		node->begin(r[i]);
+		if(probe(d)) {
+			node->begin(current);
+			return r[i];
+		}
+	}
+	node->begin(current);
+	return 0;
+}
+
+uint32_t ModbusAutoBaud::negotiate() {
+	if(count == 0) return 0;
+
+	uint32_t current = devices[0].node->baudRate();
+	// everyone must answer before anything is changed
+	if(!probeAll()) return current;
+
+	for(int i = 0; i < rateCount && r[i] > current; ++i) {
+		int switched = 0;
+		while(switched < count && devices[switched].setRate(devices[switched].node, r[i], devices[switched].arg)) {
+			++switched;
+		}
+		if(switched == 0) continue;
+
+		setBus(r[i]);
+		vTaskDelay(SettleTime);
+		if(switched == count && probeAll()) return r[i];
+
+		// roll back the slaves that switched
+		for(int j = 0; j < switched; ++j) {
+			devices[j].setRate(devices[j].node, current, devices[j].arg);
+		}
+		setBus(current);
+		vTaskDelay(SettleTime);
+	}
+	return current;
+}
@@ -0,0 +1,53 @@
+/*
+ * ModbusAutoBaud.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Moves all slaves of a bus to the fastest line speed that every one of
+ *  them supports. How a slave is told to change its speed is device
+ *  specific (register address, encoding, whether a restart is needed) so
+ *  each device provides a hook that does it. The hook is called at the
+ *  current speed and must return when the slave listens at the new speed.
+ *
+ *  A rate is accepted only if every slave answers at it; otherwise the
+ *  slaves that already switched are returned to the previous speed.
+ */
+
+#ifndef MODBUSAUTOBAUD_H_
+#define MODBUSAUTOBAUD_H_
+
+#include "ModbusMaster.h"
+
+class ModbusAutoBaud {
+public:
+	static const int MaxDevices = 8;
+	/* make the slave use a new line speed. Returns false if the slave does not support it */
+	typedef bool (*SetRate)(ModbusMaster *node, uint32_t bps, void *arg);
+
+	ModbusAutoBaud(const uint32_t *rates, int count); /* candidate rates, fastest first */
+	ModbusAutoBaud(const ModbusAutoBaud &) = delete;
+	virtual ~ModbusAutoBaud();
+	/* add a slave. probeRegister is any holding register that the slave answers to */
+	bool add(ModbusMaster *node, uint16_t probeRegister, SetRate setRate, void *arg = nullptr);
+	/* try the candidate rates that are faster than the current one. Returns the speed in use afterwards */
+	uint32_t negotiate();
+	uint32_t find(ModbusMaster *node, uint16_t probeRegister); /* rate at which a slave answers, 0 if none */
+private:
+	struct Device {
+		ModbusMaster *node;
+		uint16_t probeRegister;
+		SetRate setRate;
+		void *arg;
+	};
+	static const TickType_t SettleTime = 100; /* slaves may need time to apply a new speed */
+	static const uint16_t ProbeTimeout = 200; /* [ms] a slave at the right speed answers well within this */
+	bool probe(const Device &d);
+	bool probeAll();
+	void setBus(uint32_t bps);
+	const uint32_t *r;
+	int rateCount;
+	Device devices[MaxDevices];
+	int count;
+};
+
+#endif /* MODBUSAUTOBAUD_H_ */
@@ -0,0 +1,117 @@
+/*
+ * ModbusBus.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include <mutex>
+#include "ModbusBus.h"
+
+ModbusBus::ModbusBus(const char *name, UBaseType_t priority, int queueLength)
+	: handle(nullptr), pollCount(0), lastPoll(-1) {
+	queue = xQueueCreate(queueLength, sizeof(Request));
+	// one completion semaphore for each request that can be queued or in service at the same time
+	pool = xQueueCreate(queueLength + 1, sizeof(SemaphoreHandle_t));
+	for(int i = 0; i < queueLength + 1; ++i) {
+		SemaphoreHandle_t done = xSemaphoreCreateBinary();
+		if(done) xQueueSendToBack(pool, &done, 0);
+	}
+	// stack must hold a Modbus ADU (256 bytes) on top of what the callbacks need
+	xTaskCreate(task, name, configMINIMAL_STACK_SIZE * 4, this, priority, &handle);
+}
+
+ModbusBus::~ModbusBus() {
+	if(handle) vTaskDelete(handle);
+	vQueueDelete(queue);
+	SemaphoreHandle_t done;
+	while(xQueueReceive(pool, &done, 0) == pdTRUE) vSemaphoreDelete(done);
+	vQueueDelete(pool);
+}
+
+bool ModbusBus::run(void (*fn)(void *arg), void *arg, bool urgent, TickType_t timeout) {
+	// called from a poll or another request: we already own the bus
+	if(xTaskGetCurrentTaskHandle() == handle) {
+		fn(arg);
+		return true;
+	}
+
+	// a semaphore from the pool: a task notification could be confused with the other users of the caller's notifications
+	SemaphoreHandle_t done;
+	if(xQueueReceive(pool, &done, timeout) != pdTRUE) return false;
+	Request r = { fn, arg, done };
+	BaseType_t ok = urgent ? xQueueSendToFront(queue, &r, timeout) : xQueueSendToBack(queue, &r, timeout);
+
+	// request refers to our stack so we must not return before it has been executed
+	if(ok == pdTRUE) xSemaphoreTake(done, portMAX_DELAY);
+	xQueueSendToBack(pool, &done, 0);
+	return ok == pdTRUE;
+}
+
+bool ModbusBus::addPoll(void (*fn)(void *arg), void *arg, TickType_t period) {
+	std::lock_guard<Fmutex> lock(pollMutex);
+
+	if(pollCount >= MaxPolls) return false;
+
+	polls[pollCount].fn = fn;
+	polls[pollCount].arg = arg;
+	polls[pollCount].period = period;
+	polls[pollCount].next = xTaskGetTickCount();
+	++pollCount;
+
+	// bus task may be waiting for a request or for a later poll: make it recompute the wait.
+	// If the queue is full the task is not blocked anyway
+	Request wake = { nullptr, nullptr, nullptr };
+	xQueueSendToFront(queue, &wake, 0);
+
+	return true;
+}
+
+void ModbusBus::task(void *pvParameters) {
+	static_cast<ModbusBus *>(pvParameters)->serve();
+}
+
+/* Find the next due poll starting after the one served last. If none is due,
+ * wait is set to the number of ticks until the earliest poll becomes due. */
+int ModbusBus::duePoll(TickType_t now, TickType_t &wait) {
+	std::lock_guard<Fmutex> lock(pollMutex);
+
+	wait = portMAX_DELAY;
+	for(int n = 1; n <= pollCount; ++n) {
+		int i = (lastPoll + n) % pollCount;
+		TickType_t left = polls[i].next - now;
+		// tick counter wraps: anything "more than a period away" is overdue
+		if(left == 0 || left > polls[i].period) return i;
+		if(left < wait) wait = left;
+	}
+	return -1;
+}
+
+void ModbusBus::serve() {
+	bool pollTurn = false;
+	Request r;
+
+	while(true) {
+		TickType_t now = xTaskGetTickCount();
+		TickType_t wait;
+		int p = duePoll(now, wait);
+
+		// alternate between requests and polls so that neither can starve the other
+		if(p >= 0 && (pollTurn || uxQueueMessagesWaiting(queue) == 0)) {
+			Poll &poll = polls[p];
+			poll.fn(poll.arg);
+			poll.next += poll.period;
+			// don't try to catch up on missed periods
+			if(poll.next - xTaskGetTickCount() > poll.period) poll.next = xTaskGetTickCount() + poll.period;
+			lastPoll = p;
+			pollTurn = false;
+		}
+		else if(xQueueReceive(queue, &r, p >= 0 ? 0 : wait) == pdTRUE) {
+			// no-op requests only wake us up, see addPoll()
+			if(r.fn) {
+				r.fn(r.arg);
+				xSemaphoreGive(r.done);
+				pollTurn = true;
+			}
+		}
+	}
+}
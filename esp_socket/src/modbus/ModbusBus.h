@@ -0,0 +1,59 @@
+/*
+ * ModbusBus.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Bus manager task that owns one RS-485 Modbus port. All transactions on
+ *  the bus are executed by this task, one at a time, so that several
+ *  application tasks can use devices on the same bus without collisions.
+ *  Work is either submitted by other tasks with run() or registered as a
+ *  periodic poll with addPoll(). Queued requests and due polls are served
+ *  in turns, and due polls are served round-robin.
+ */
+
+#ifndef MODBUSBUS_H_
+#define MODBUSBUS_H_
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "Fmutex.h"
+
+class ModbusBus {
+public:
+	ModbusBus(const char *name = "modbus", UBaseType_t priority = tskIDLE_PRIORITY + 2, int queueLength = 8);
+	ModbusBus(const ModbusBus &) = delete;
+	virtual ~ModbusBus();
+	/* Execute fn(arg) in the bus task and block until it has completed. Urgent requests are queued
+	 * ahead of normal ones. Timeout applies only to queuing; once queued the call waits for completion.
+	 * Returns false if the request could not be queued. Task notifications of the caller are not used. */
+	bool run(void (*fn)(void *arg), void *arg, bool urgent = false, TickType_t timeout = portMAX_DELAY);
+	/* Execute fn(arg) in the bus task every period ticks. Typically one poll per slave device */
+	bool addPoll(void (*fn)(void *arg), void *arg, TickType_t period);
+private:
+	struct Request {
+		void (*fn)(void *arg);
+		void *arg;
+		SemaphoreHandle_t done; /* given when fn has returned */
+	};
+	struct Poll {
+		void (*fn)(void *arg);
+		void *arg;
+		TickType_t period;
+		TickType_t next;
+	};
+	static const int MaxPolls = 16;
+	static void task(void *pvParameters);
+	void serve();
+	int duePoll(TickType_t now, TickType_t &wait);
+	QueueHandle_t queue;
+	QueueHandle_t pool; /* free completion semaphores of run() */
+	TaskHandle_t handle;
+	Fmutex pollMutex;
+	Poll polls[MaxPolls];
+	int pollCount;
+	int lastPoll; /* index of the poll that was served last */
+};
+
+#endif /* MODBUSBUS_H_ */
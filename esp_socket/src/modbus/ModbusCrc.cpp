@@ -0,0 +1,189 @@
+/*
+ * ModbusCrc.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include <cstdio>
+#include "ModbusCrc.h"
+#include "ModbusStats.h"
+#include "crc16.h"
+#include "chip.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#if MODBUS_CRC_BACKEND != MODBUS_CRC_NIBBLE
+// crc16_update() applied to every byte value
+static const uint16_t crc_table[256] = {
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+#endif
+
+// crc16_update() applied to every nibble value
+static const uint16_t crc_nibble_table[16] = {
+	0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+	0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+};
+
+uint16_t ModbusCrc::compute(const uint8_t *data, int len)
+{
+#if MODBUS_CRC_BACKEND == MODBUS_CRC_BITWISE
+	return bitwise(data, len);
+#elif MODBUS_CRC_BACKEND == MODBUS_CRC_NIBBLE
+	return nibble(data, len);
+#elif MODBUS_CRC_BACKEND == MODBUS_CRC_HARDWARE
+	return hardware(data, len);
+#else
+	return table(data, len);
+#endif
+}
+
+uint16_t ModbusCrc::bitwise(const uint8_t *data, int len, uint16_t crc)
+{
+	while(len-- > 0) crc = crc16_update(crc, *data++);
+	return crc;
+}
+
+uint16_t ModbusCrc::table(const uint8_t *data, int len, uint16_t crc)
+{
+#if MODBUS_CRC_BACKEND != MODBUS_CRC_NIBBLE
+	while(len-- > 0) crc = (crc >> 8) ^ crc_table[(crc ^ *data++) & 0xFF];
+	return crc;
+#else
+	// table left out to save flash
+	return nibble(data, len, crc);
+#endif
+}
+
+uint16_t ModbusCrc::nibble(const uint8_t *data, int len, uint16_t crc)
+{
+	while(len-- > 0) {
+		// reflected CRC: low nibble first
+		crc = (crc >> 4) ^ crc_nibble_table[(crc ^ *data) & 0x0F];
+		crc = (crc >> 4) ^ crc_nibble_table[(crc ^ (*data >> 4)) & 0x0F];
+		++data;
+	}
+	return crc;
+}
+
+uint16_t ModbusCrc::hardware(const uint8_t *data, int len, uint16_t crc)
+{
+	static bool init;
+
+	// CRC engine is shared by all tasks and interrupts
+	UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+	if(!init) {
+		Chip_CRC_Init();
+		init = true;
+	}
+	// CRC-16 polynomial (0x8005) with reflected input and output is the Modbus CRC
+	Chip_CRC_SetPoly(CRC_POLY_CRC16, CRC_MODE_WRDATA_BIT_RVS | CRC_MODE_SUM_BIT_RVS);
+	// seed is given in the engine's (non-reflected) bit order
+	Chip_CRC_SetSeed(__RBIT(crc) >> 16);
+	while(len-- > 0) Chip_CRC_Write8(*data++);
+	crc = (uint16_t) Chip_CRC_Sum();
+	taskEXIT_CRITICAL_FROM_ISR(mask);
+
+	return crc;
+}
+
+bool ModbusCrc::verify(const uint8_t *frame, int len)
+{
+	if(len < 2) return false;
+	uint16_t crc = compute(frame, len - 2);
+	return frame[len - 2] == (crc & 0xFF) && frame[len - 1] == (crc >> 8);
+}
+
+typedef uint16_t (*Backend)(const uint8_t *, int, uint16_t);
+static const Backend backends[] = { ModbusCrc::bitwise, ModbusCrc::table, ModbusCrc::nibble, ModbusCrc::hardware };
+static const char *names[] = { "bitwise", "table", "nibble", "hardware" };
+static const int backendCount = sizeof(backends) / sizeof(backends[0]);
+
+// simple LCG is good enough for test data
+static uint32_t lcg(uint32_t &seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+bool ModbusCrc::selfTest(int frames, uint32_t seed)
+{
+	// read holding register request of the Modbus specification: CRC is 0x0A84
+	static const uint8_t known[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x01 };
+	uint8_t frame[256];
+
+	for(int b = 0; b < backendCount; ++b) {
+		if(backends[b](known, sizeof(known), 0xFFFF) != 0x0A84) return false;
+	}
+
+	for(int f = 0; f < frames; ++f) {
+		int len = lcg(seed) % (sizeof(frame) + 1);
+		for(int i = 0; i < len; ++i) frame[i] = (uint8_t) lcg(seed);
+		uint16_t init = (f % 4 == 0) ? 0xFFFF : (uint16_t) lcg(seed);
+		int split = lcg(seed) % (len + 1);
+		uint16_t expected = bitwise(frame, len, init);
+
+		for(int b = 0; b < backendCount; ++b) {
+			if(backends[b](frame, len, init) != expected) return false;
+			// chained: the CRC of the first part seeds the next backend for the rest
+			uint16_t first = backends[b](frame, split, init);
+			if(backends[(b + 1) % backendCount](frame + split, len - split, first) != expected) return false;
+		}
+	}
+	return true;
+}
+
+bool ModbusCrc::benchmark(char *buffer, int size, int len)
+{
+	uint8_t frame[256];
+	uint32_t seed = 12345;
+
+	if(len < 1 || len > (int) sizeof(frame)) len = sizeof(frame);
+	for(int i = 0; i < len; ++i) frame[i] = (uint8_t) lcg(seed);
+
+	ModbusStats::begin();
+	uint16_t expected = bitwise(frame, len, 0xFFFF);
+	bool agree = true;
+	int n = snprintf(buffer, size, "crc cycles/byte:");
+	for(int b = 0; b < backendCount; ++b) {
+		uint32_t start = ModbusStats::cycles();
+		uint16_t crc = backends[b](frame, len, 0xFFFF);
+		uint32_t tenths = (ModbusStats::cycles() - start) * 10 / len;
+		if(crc != expected) agree = false;
+		if(n < size) n += snprintf(buffer + n, size - n, " %s %lu.%lu", names[b],
+				(unsigned long) (tenths / 10), (unsigned long) (tenths % 10));
+	}
+	if(n < size) snprintf(buffer + n, size - n, agree ? "\r\n" : " MISMATCH\r\n");
+	return agree;
+}
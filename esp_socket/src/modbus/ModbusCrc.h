@@ -0,0 +1,55 @@
+/*
+ * ModbusCrc.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Modbus RTU CRC-16 (polynomial 0xA001 reflected, initial value 0xFFFF)
+ *  with selectable implementations:
+ *    - bitwise:  crc16_update() from crc16.h, no tables
+ *    - table:    256-entry lookup table, 512 bytes of flash, one lookup per byte
+ *    - nibble:   16-entry lookup table, 32 bytes of flash, two lookups per byte
+ *    - hardware: LPC15xx CRC engine, no tables
+ *  All variants give identical results. MODBUS_CRC_BACKEND selects the one
+ *  used by ModbusCrc::compute(); benchmark() helps choosing it on the target.
+ *  A build with MODBUS_CRC_TEST set to 1 runs selfTest() and benchmark() at
+ *  start up. They are not part of a normal build.
+ */
+
+#ifndef MODBUSCRC_H_
+#define MODBUSCRC_H_
+
+#include <stdint.h>
+
+#define MODBUS_CRC_BITWISE  0
+#define MODBUS_CRC_TABLE    1
+#define MODBUS_CRC_NIBBLE   2
+#define MODBUS_CRC_HARDWARE 3
+
+#ifndef MODBUS_CRC_BACKEND
+#define MODBUS_CRC_BACKEND MODBUS_CRC_TABLE
+#endif
+
+#ifndef MODBUS_CRC_TEST
+#define MODBUS_CRC_TEST 0
+#endif
+
+class ModbusCrc {
+public:
+	static uint16_t compute(const uint8_t *data, int len); /* CRC with the selected backend */
+	static uint16_t bitwise(const uint8_t *data, int len, uint16_t crc = 0xFFFF);
+	static uint16_t table(const uint8_t *data, int len, uint16_t crc = 0xFFFF);
+	static uint16_t nibble(const uint8_t *data, int len, uint16_t crc = 0xFFFF);
+	static uint16_t hardware(const uint8_t *data, int len, uint16_t crc = 0xFFFF);
+	/* check the CRC in the last two bytes of a frame */
+	static bool verify(const uint8_t *frame, int len);
+	/* Check that all backends agree on frames of random length (0..256) with random initial
+	 * values, and when the computation is split at a random point and chained from one backend
+	 * to another. Returns true if they all agree */
+	static bool selfTest(int frames = 1000, uint32_t seed = 1);
+	/* Measure the cycles per byte of each backend with the DWT cycle counter on a pseudo random
+	 * frame of len bytes and write the results as one line for the debug UART.
+	 * Returns true if all backends agree */
+	static bool benchmark(char *buffer, int size, int len = 256);
+};
+
+#endif /* MODBUSCRC_H_ */
@@ -0,0 +1,112 @@
+/*
+ * ModbusGapTimer.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include "ModbusGapTimer.h"
+
+static ModbusGapTimer *gt;
+
+extern "C" {
+/**
+ * @brief	RIT interrupt handler. Signals the end of a Modbus RTU frame
+ * @return	Nothing
+ */
+void RIT_IRQHandler(void)
+{
+	portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+
+	if(gt) {
+		gt->isr(&xHigherPriorityTaskWoken);
+	}
+	else {
+		Chip_RIT_ClearIntStatus(LPC_RITIMER);
+	}
+
+	portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
+}
+}
+
+ModbusGapTimer::ModbusGapTimer() : tchar(0), t15(0), t35(0), running(false), expired(nullptr), expired_arg(nullptr) {
+	if(gt) return; // there is only one RIT
+	gt = this;
+
+	Chip_RIT_Init(LPC_RITIMER);
+	Chip_RIT_Disable(LPC_RITIMER);
+	// counter clears on compare match so that the counter value is the time since the last character
+	Chip_RIT_EnableCompClear(LPC_RITIMER);
+	setBaudRate(9600);
+
+	// same priority as the UARTs so that restart() and isr() don't preempt each other
+	NVIC_SetPriority(RITIMER_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+	NVIC_EnableIRQ(RITIMER_IRQn);
+}
+
+ModbusGapTimer::~ModbusGapTimer() {
+	if(gt == this) {
+		NVIC_DisableIRQ(RITIMER_IRQn);
+		Chip_RIT_DeInit(LPC_RITIMER);
+		gt = nullptr;
+	}
+}
+
+void ModbusGapTimer::setBaudRate(uint32_t bps, int bitsPerChar, uint32_t frameGapUs)
+{
+	uint32_t clk = Chip_RIT_GetBaseClock(LPC_RITIMER);
+
+	tchar = (uint64_t) clk * bitsPerChar / bps;
+	if(bps > 19200) {
+		// Modbus specification recommends fixed values above 19200 bps
+		t15 = clk / 1000000 * 750;
+		t35 = clk / 1000000 * 1750;
+	}
+	else {
+		t15 = tchar * 3 / 2;
+		t35 = tchar * 7 / 2;
+	}
+	if(frameGapUs) {
+		t35 = clk / 1000000 * frameGapUs;
+	}
+	Chip_RIT_SetCompareValue(LPC_RITIMER, t35);
+}
+
+bool ModbusGapTimer::inUse()
+{
+	return gt != nullptr;
+}
+
+void ModbusGapTimer::attach(void (*cb)(void *arg, portBASE_TYPE *hpw), void *arg)
+{
+	NVIC_DisableIRQ(RITIMER_IRQn);
+	stop();
+	expired_arg = arg;
+	expired = cb;
+	NVIC_EnableIRQ(RITIMER_IRQn);
+}
+
+bool ModbusGapTimer::restart()
+{
+	// receive interrupts come at the end of characters: the interval includes the character itself
+	bool ok = !running || LPC_RITIMER->COUNTER <= tchar + t15;
+
+	Chip_RIT_SetCounter(LPC_RITIMER, 0);
+	running = true;
+	Chip_RIT_Enable(LPC_RITIMER);
+
+	return ok;
+}
+
+void ModbusGapTimer::stop()
+{
+	Chip_RIT_Disable(LPC_RITIMER);
+	Chip_RIT_ClearIntStatus(LPC_RITIMER);
+	running = false;
+}
+
+void ModbusGapTimer::isr(portBASE_TYPE *hpw)
+{
+	// t3.5 of silence: stop until the next character arrives
+	stop();
+	if(expired) expired(expired_arg, hpw);
+}
@@ -0,0 +1,41 @@
+/*
+ * ModbusGapTimer.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Modbus RTU character gap timing with the repetitive interrupt timer (RIT).
+ *  The receive interrupt restarts the timer on every character. The timer
+ *  reports when more than 1.5 character times passed between characters
+ *  (corrupt frame) and calls the expiry handler after 3.5 character times
+ *  of silence (end of frame).
+ */
+
+#ifndef MODBUSGAPTIMER_H_
+#define MODBUSGAPTIMER_H_
+
+#include "chip.h"
+#include "FreeRTOS.h"
+
+class ModbusGapTimer {
+public:
+	ModbusGapTimer();
+	ModbusGapTimer(const ModbusGapTimer &) = delete;
+	virtual ~ModbusGapTimer();
+	/* compute t1.5 and t3.5 for the given line speed. frameGapUs overrides t3.5 if not zero */
+	void setBaudRate(uint32_t bps, int bitsPerChar = 11, uint32_t frameGapUs = 0);
+	void attach(void (*expired)(void *arg, portBASE_TYPE *hpw), void *arg); /* t3.5 handler, called in ISR context. nullptr to detach */
+	bool restart(); /* call from receive ISR on every character. Returns false if t1.5 was exceeded */
+	void stop();
+	static bool inUse(); /* true if the RIT has already been taken */
+
+	void isr(portBASE_TYPE *hpw); /* called by RIT_IRQHandler. Do not call from application */
+private:
+	uint32_t tchar; /* one character time in timer ticks */
+	uint32_t t15; /* 1.5 character times in timer ticks */
+	uint32_t t35; /* 3.5 character times in timer ticks */
+	volatile bool running;
+	void (* volatile expired)(void *arg, portBASE_TYPE *hpw);
+	void *expired_arg;
+};
+
+#endif /* MODBUSGAPTIMER_H_ */
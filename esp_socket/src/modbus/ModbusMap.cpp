@@ -0,0 +1,73 @@
+/*
+ * ModbusMap.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include <cstring>
+#include "ModbusMap.h"
+
+ModbusMap::ModbusMap(const ModbusField *fields, int count, bool holdingRegister)
+	: f(fields), n(count), lo(0), hi(0), hr(holdingRegister) {
+	for(int i = 0; i < n; ++i) {
+		int end = f[i].address + f[i].words();
+		if(i == 0 || f[i].address < lo) lo = f[i].address;
+		if(i == 0 || end > hi) hi = end;
+	}
+}
+
+bool ModbusMap::decode(const uint8_t *data, int address, int count, void *dest) const {
+	uint8_t *d = static_cast<uint8_t *>(dest);
+
+	// check all fields first so that dest is left untouched if any of them is missing
+	for(int i = 0; i < n; ++i) {
+		int index = f[i].address - address;
+		if(index < 0 || index + f[i].words() > count) return false;
+	}
+
+	for(int i = 0; i < n; ++i) {
+		const ModbusField &fld = f[i];
+		int index = fld.address - address;
+
+		const uint8_t *p = data + 2 * index;
+		uint32_t raw = (uint32_t)(p[0] << 8 | p[1]);
+		if(fld.words() == 2) {
+			uint32_t next = (uint32_t)(p[2] << 8 | p[3]);
+			raw = (fld.order == ModbusField::highFirst) ? (raw << 16 | next) : (next << 16 | raw);
+		}
+
+		// unscaled values are stored as they are, the bit pattern is the same for all types of a width
+		if(fld.scale == 1) {
+			if(fld.words() == 2) {
+				memcpy(d + fld.offset, &raw, sizeof(raw));
+			}
+			else {
+				uint16_t v = (uint16_t)raw;
+				memcpy(d + fld.offset, &v, sizeof(v));
+			}
+			continue;
+		}
+
+		float value;
+		switch(fld.type) {
+		case ModbusField::int16:
+			value = (int16_t)raw;
+			break;
+		case ModbusField::uint16:
+			value = (uint16_t)raw;
+			break;
+		case ModbusField::int32:
+			value = (int32_t)raw;
+			break;
+		case ModbusField::uint32:
+			value = raw;
+			break;
+		default:
+			memcpy(&value, &raw, sizeof(value));
+			break;
+		}
+		value /= fld.scale;
+		memcpy(d + fld.offset, &value, sizeof(value));
+	}
+	return true;
+}
@@ -0,0 +1,59 @@
+/*
+ * ModbusMap.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Register map that decodes a Modbus read response straight from the
+ *  received frame into the members of a caller-declared structure.
+ *  Each field describes one value: register address, encoding, word
+ *  order of 32-bit values and scaling. Scaled fields are stored as float,
+ *  unscaled fields as the C type that matches the encoding.
+ */
+
+#ifndef MODBUSMAP_H_
+#define MODBUSMAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct ModbusField {
+	enum Type : uint8_t {
+		int16,   /* int16_t  */
+		uint16,  /* uint16_t */
+		int32,   /* int32_t, two registers */
+		uint32,  /* uint32_t, two registers */
+		float32  /* IEEE 754 float, two registers */
+	};
+	enum Order : uint8_t {
+		highFirst, /* first register holds the high word (Modbus convention) */
+		lowFirst   /* first register holds the low word */
+	};
+
+	uint16_t address; /* register address */
+	Type type;
+	Order order;
+	float scale;      /* raw value is divided by scale. 1 = stored unscaled */
+	uint16_t offset;  /* offsetof() the destination member */
+
+	int words() const { return type >= int32 ? 2 : 1; }
+};
+
+class ModbusMap {
+public:
+	ModbusMap(const ModbusField *fields, int count, bool holdingRegister = true);
+	ModbusMap(const ModbusMap &) = delete;
+	int first() const { return lo; } /* address of the first register in the map */
+	int span() const { return hi - lo; } /* number of registers that one read must cover */
+	bool holding() const { return hr; }
+	/* Decode registers address..address+count-1 given as big endian bytes as in the response PDU.
+	 * Returns false without modifying dest if the registers don't cover all fields */
+	bool decode(const uint8_t *data, int address, int count, void *dest) const;
+private:
+	const ModbusField *f;
+	int n;
+	int lo;
+	int hi;
+	bool hr;
+};
+
+#endif /* MODBUSMAP_H_ */
@@ -30,7 +30,10 @@ Arduino library for communicating with Modbus slaves over RS232/485 (via RTU pro
 
 /* _____PROJECT INCLUDES_____________________________________________________ */
 #include "ModbusMaster.h"
-#include "crc16.h"
+#include "ModbusCrc.h"
+extern "C" {
+#include "backoff_algorithm.h"
+}
 
 
 /* _____GLOBAL VARIABLES_____________________________________________________ */
@@ -55,7 +58,7 @@ ModbusMaster::ModbusMaster(void)
 {
   _u8SerialPort = 0;
   _u8MBSlave = 1;
-  _u16BaudRate = 0;
+  _u32BaudRate = 0;
 }
 
 
@@ -72,7 +75,7 @@ ModbusMaster::ModbusMaster(uint8_t u8MBSlave)
 {
   _u8SerialPort = 0;
   _u8MBSlave = u8MBSlave;
-  _u16BaudRate = 0;
+  _u32BaudRate = 0;
 }
 
 
@@ -90,7 +93,27 @@ ModbusMaster::ModbusMaster(uint8_t u8SerialPort, uint8_t u8MBSlave)
 {
   _u8SerialPort = (u8SerialPort > 3) ? 0 : u8SerialPort;
   _u8MBSlave = u8MBSlave;
-  _u16BaudRate = 0;
+  _u32BaudRate = 0;
+}
+
+
+/**
+Constructor.
+
+Creates class object on the given RS-485 bus, specified Modbus slave ID.
+Masters on different buses run transactions independently of each other.
+
+@overload void ModbusMaster::ModbusMaster(uint8_t u8MBSlave, SerialPort *port)
+@param u8MBSlave Modbus slave ID (1..255)
+@param port bus of the slave, NULL for the default bus
+@ingroup setup
+*/
+ModbusMaster::ModbusMaster(uint8_t u8MBSlave, SerialPort *port)
+{
+  _u8SerialPort = 0;
+  _u8MBSlave = u8MBSlave;
+  _u32BaudRate = 0;
+  MBSerial = port;
 }
 
 
@@ -111,14 +134,35 @@ void ModbusMaster::begin(void)
 /**
 Initialize class object.
 
-Sets up the serial port using specified baud rate.
+Sets up the serial port using specified baud rate. Other line settings
+of the bus are not changed.
 Call once class has been instantiated, typically within setup().
 
-@overload ModbusMaster::begin(uint16_t u16BaudRate)
-@param u16BaudRate baud rate, in standard increments (300..115200)
+@overload ModbusMaster::begin(uint32_t u32BaudRate)
+@param u32BaudRate baud rate, in standard increments (300..115200)
 @ingroup setup
 */
-void ModbusMaster::begin(uint16_t u16BaudRate)
+void ModbusMaster::begin(uint32_t u32BaudRate)
+{
+  if(MBSerial == NULL) MBSerial = SerialPort::defaultPort();
+  SerialPortConfig cfg = MBSerial->config();
+  cfg.speed = u32BaudRate;
+  begin(cfg);
+}
+
+
+/**
+Initialize class object.
+
+Sets up the serial port with the given line settings: speed, parity, stop
+bits, RS-485 driver turnaround and inter-frame gap. The settings apply to
+the whole bus, i.e. to all slaves on the same port.
+
+@overload ModbusMaster::begin(const SerialPortConfig &cfg)
+@param cfg line settings
+@ingroup setup
+*/
+void ModbusMaster::begin(const SerialPortConfig &cfg)
 {
 //  txBuffer = (uint16_t*) calloc(ku8MaxBufferSize, sizeof(uint16_t));
   _u8TransmitBufferIndex = 0;
@@ -152,10 +196,17 @@ void ModbusMaster::begin(uint16_t u16BaudRate)
   }
 #endif
 
-  if(MBSerial == NULL) MBSerial = new SerialPort;
-  if(u16BaudRate !=  _u16BaudRate) {
-	  _u16BaudRate = u16BaudRate;
-	  MBSerial->begin(u16BaudRate);
+  if(MBSerial == NULL) MBSerial = SerialPort::defaultPort();
+  _gapTimer = MBSerial->gapTimer();
+  ModbusStats::begin();
+  MBSerial->configure(cfg);
+  if(cfg.speed != _u32BaudRate) {
+	  _u32BaudRate = cfg.speed;
+	  // response times change with the baud rate and the slave gets a fresh start
+	  _i32Srtt8 = -1;
+	  _u16Timeout = ku16MBInitialTimeout;
+	  _u8Failures = 0;
+	  _offline = false;
   }
   _idle = NULL;
 
@@ -444,6 +495,33 @@ uint8_t ModbusMaster::readHoldingRegisters(uint16_t u16ReadAddress,
 }
 
 
+/**
+Read the registers of a register map.
+
+All registers from the lowest to the highest address of the map are read in
+one transaction and the fields are decoded straight from the received frame
+into the structure pointed to by dest. The response buffer is not modified.
+
+@param map register map describing the fields of dest
+@param dest structure that receives the decoded values
+@return 0 on success; exception number on failure
+@ingroup register
+*/
+uint8_t ModbusMaster::readRegisters(const ModbusMap &map, void *dest)
+{
+  uint8_t u8MBStatus;
+
+  _u16ReadAddress = map.first();
+  _u16ReadQty = map.span();
+  _decodeMap = &map;
+  _decodeDest = dest;
+  u8MBStatus = ModbusMasterTransaction(map.holding() ? ku8MBReadHoldingRegisters : ku8MBReadInputRegisters);
+  _decodeMap = nullptr;
+  _decodeDest = nullptr;
+  return u8MBStatus;
+}
+
+
 /**
 Modbus function 0x04 Read Input Registers.
 
@@ -644,6 +722,227 @@ uint8_t ModbusMaster::readWriteMultipleRegisters(uint16_t u16ReadAddress,
 }
 
 
+/**
+Start a Modbus function 0x03 Read Holding Registers transaction.
+
+Sends the request and returns without waiting for the response. Use
+ModbusMaster::poll() or ModbusMaster::wait() to complete the
+transaction; the registers are then available in the response buffer.
+
+@param u16ReadAddress address of the first holding register (0x0000..0xFFFF)
+@param u16ReadQty quantity of holding registers to read (1..125, enforced by remote device)
+@return 0 if request was sent; exception number on failure
+@ingroup register
+*/
+uint8_t ModbusMaster::startReadHoldingRegisters(uint16_t u16ReadAddress,
+  uint16_t u16ReadQty)
+{
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16ReadQty;
+  return startTransaction(ku8MBReadHoldingRegisters);
+}
+
+
+/**
+Start a Modbus function 0x04 Read Input Registers transaction.
+
+@see ModbusMaster::startReadHoldingRegisters()
+@param u16ReadAddress address of the first input register (0x0000..0xFFFF)
+@param u16ReadQty quantity of input registers to read (1..125, enforced by remote device)
+@return 0 if request was sent; exception number on failure
+@ingroup register
+*/
+uint8_t ModbusMaster::startReadInputRegisters(uint16_t u16ReadAddress,
+  uint8_t u16ReadQty)
+{
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16ReadQty;
+  return startTransaction(ku8MBReadInputRegisters);
+}
+
+
+/**
+Start a Modbus function 0x06 Write Single Register transaction.
+
+@see ModbusMaster::startReadHoldingRegisters()
+@param u16WriteAddress address of the holding register (0x0000..0xFFFF)
+@param u16WriteValue value to be written to holding register (0x0000..0xFFFF)
+@return 0 if request was sent; exception number on failure
+@ingroup register
+*/
+uint8_t ModbusMaster::startWriteSingleRegister(uint16_t u16WriteAddress,
+  uint16_t u16WriteValue)
+{
+  _u16WriteAddress = u16WriteAddress;
+  _u16WriteQty = 0;
+  _u16TransmitBuffer[0] = u16WriteValue;
+  return startTransaction(ku8MBWriteSingleRegister);
+}
+
+
+/**
+Check if the transaction started with one of the start functions has
+completed. Does not block.
+
+@return true when the result is available from ModbusMaster::wait()
+*/
+bool ModbusMaster::poll()
+{
+  if (!_pending)
+  {
+    return true;
+  }
+  if (!_gapTimer)
+  {
+    receive(millis()); // collect what has arrived without waiting
+  }
+  return _rx.done() || (millis() - _u32StartTime) > _u16WaitTimeout;
+}
+
+
+/**
+Wait for the transaction started with one of the start functions to
+complete with a shorter timeout than the adaptive one, for example to
+probe a slave. A timeout of a shortened wait does not grow the adaptive
+timeout.
+
+@param u16Timeout response timeout [milliseconds]
+@return 0 on success; exception number on failure
+*/
+uint8_t ModbusMaster::wait(uint16_t u16Timeout)
+{
+  if (_pending && u16Timeout < _u16WaitTimeout)
+  {
+    _u16WaitTimeout = u16Timeout;
+  }
+  return wait();
+}
+
+
+/**
+Wait for the transaction started with one of the start functions to
+complete.
+
+The calling task sleeps until the receive interrupt signals that the
+whole response has arrived or the response timeout expires. If an idle
+callback has been set, it is called repeatedly instead of sleeping.
+
+@return 0 on success; exception number on failure
+*/
+uint8_t ModbusMaster::wait()
+{
+  if (!_pending)
+  {
+    return _u8MBStatus;
+  }
+
+  if (_idle)
+  {
+    while (!poll())
+    {
+      _idle();
+    }
+  }
+  else if (!_gapTimer)
+  {
+    receive(_u32StartTime + _u16WaitTimeout + 1);
+  }
+  else
+  {
+    _waiter = xTaskGetCurrentTaskHandle();
+    while (!_rx.done())
+    {
+      uint32_t u32Elapsed = millis() - _u32StartTime;
+      if (u32Elapsed > _u16WaitTimeout)
+      {
+        break;
+      }
+      // notifications from other sources are harmless; the loop re-checks the receiver
+      ulTaskNotifyTake(pdTRUE, _u16WaitTimeout - u32Elapsed + 1);
+    }
+    _waiter = NULL;
+  }
+
+  return finishTransaction();
+}
+
+
+/**
+Receive the response on a bus without a gap timer. The response is read
+from the serial port in whole frames and the task sleeps in between. A
+quiet line after the first characters ends the frame before the deadline.
+
+@param deadline tick count when to stop waiting
+*/
+void ModbusMaster::receive(TickType_t deadline)
+{
+  uint8_t buf[32];
+  TickType_t gap = MBSerial->frameGapTicks();
+  TickType_t until = deadline;
+
+  while (!_rx.done())
+  {
+    int n = MBSerial->readFrame(buf, sizeof(buf), until, gap);
+    for (int i = 0; i < n && !_rx.done(); ++i)
+    {
+      _rx.feed(buf[i]);
+    }
+    if (n < (int) sizeof(buf))
+    {
+      // returning early with data means the line went quiet
+      if (n > 0 && (int32_t) (deadline - millis()) > 0)
+      {
+        _rx.endOfFrame();
+      }
+      break;
+    }
+    // buffer was filled: the rest of the frame must follow without a gap
+    if ((int32_t) (deadline - (millis() + gap)) > 0)
+    {
+      until = millis() + gap;
+    }
+  }
+}
+
+
+/**
+Current line speed of the bus.
+
+@return baud rate
+*/
+uint32_t ModbusMaster::baudRate()
+{
+  return MBSerial ? MBSerial->config().speed : 0;
+}
+
+
+/**
+Check if the slave is online. A slave is taken offline after
+ku8MBOfflineThreshold failed transactions in a row and is then only probed
+every ku16MBProbeInterval milliseconds until it responds again.
+
+@return true if transactions are sent to the slave
+*/
+bool ModbusMaster::online()
+{
+  return !_offline;
+}
+
+
+/**
+Current response timeout of the slave. The timeout adapts to the observed
+response times: smoothed response time plus four times its variation, but
+at least ku16MBTimeoutMargin above the smoothed response time and at most
+ku16MBResponseTimeout.
+
+@return response timeout [milliseconds]
+*/
+uint16_t ModbusMaster::responseTimeout()
+{
+  return _u16Timeout;
+}
+
+
 /* _____PRIVATE FUNCTIONS____________________________________________________ */
 /**
 Modbus transaction engine.
@@ -655,18 +954,214 @@ Sequence:
   - evaluate/disassemble response
   - return status (success/exception)
 
+Blocking wrapper around ModbusMaster::startTransaction() and
+ModbusMaster::wait(). Requests to slave address 0 are broadcasts: they
+are not answered and complete after the turnaround delay. Transactions that fail because of the line (timeout,
+corrupted frame) are retried up to ku8MBMaxRetries times with exponential
+backoff. A slave that fails ku8MBOfflineThreshold attempts in a row is
+taken offline: transactions fail immediately with ku8MBSlaveOffline except
+for a single attempt every ku16MBProbeInterval milliseconds that brings the
+slave back on success. Probes use a short timeout that does not grow.
+
 @param u8MBFunction Modbus function (0x01..0xFF)
 @return 0 on success; exception number on failure
 */
 uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction)
+{
+  uint8_t u8MBStatus;
+  uint8_t u8Retries = ku8MBMaxRetries;
+  BackoffAlgorithmContext_t backoff;
+  uint16_t u16Backoff;
+  bool probe = false;
+
+  if (_offline)
+  {
+    if ((millis() - _u32OfflineSince) < ku16MBProbeInterval)
+    {
+      return ku8MBSlaveOffline;
+    }
+    // probe
+    _u32OfflineSince = millis();
+    u8Retries = 0;
+    probe = true;
+  }
+
+  BackoffAlgorithm_InitializeParams(&backoff, ku16MBRetryBackoffBase, ku16MBRetryBackoffMax, u8Retries);
+  while (true)
+  {
+    u8MBStatus = startTransaction(u8MBFunction);
+    if (u8MBStatus == ku8MBSuccess)
+    {
+      u8MBStatus = probe ? wait(probeTimeout()) : wait();
+    }
+
+    // circuit breaker counts attempts; any response, including an exception, shows that the slave is alive
+    if (!retryable(u8MBStatus))
+    {
+      _u8Failures = 0;
+      _offline = false;
+      break;
+    }
+    if (!_offline && ++_u8Failures >= ku8MBOfflineThreshold)
+    {
+      _offline = true;
+      _u32OfflineSince = millis();
+    }
+    if (_offline ||
+      BackoffAlgorithm_GetNextBackoff(&backoff, ModbusStats::cycles(), &u16Backoff) != BackoffAlgorithmSuccess)
+    {
+      break;
+    }
+    ModbusStats::retry(_u8MBSlave);
+    vTaskDelay(pdMS_TO_TICKS(u16Backoff));
+  }
+
+  // give the slaves time to execute a broadcast before the next request
+  if (_u8MBSlave == 0)
+  {
+    vTaskDelay(pdMS_TO_TICKS(ku16MBTurnaroundDelay));
+  }
+  return u8MBStatus;
+}
+
+
+/**
+Transactions that failed because of the line or a silent slave are worth
+retrying. Exceptions are answers from the slave and are not.
+*/
+bool ModbusMaster::retryable(uint8_t u8MBStatus)
+{
+  return u8MBStatus == ku8MBResponseTimedOut || u8MBStatus == ku8MBInvalidCRC ||
+    u8MBStatus == ku8MBInvalidFrame || u8MBStatus == ku8MBInvalidSlaveID;
+}
+
+
+/**
+Update the adaptive response timeout with a measured response time. Uses
+the smoothed round trip time estimator of TCP (RFC 6298) in fixed point.
+*/
+void ModbusMaster::updateTimeout(uint32_t u32ResponseTime)
+{
+  int32_t i32Time = u32ResponseTime;
+  int32_t i32Margin;
+  uint32_t u32Timeout;
+
+  if (_i32Srtt8 < 0)
+  {
+    _i32Srtt8 = i32Time << 3;
+    _i32Rttvar4 = i32Time << 1;
+  }
+  else
+  {
+    int32_t i32Err = i32Time - (_i32Srtt8 >> 3);
+    _i32Srtt8 += i32Err;
+    if (i32Err < 0)
+    {
+      i32Err = -i32Err;
+    }
+    _i32Rttvar4 += i32Err - (_i32Rttvar4 >> 2);
+  }
+
+  i32Margin = _i32Rttvar4 > ku16MBTimeoutMargin ? _i32Rttvar4 : ku16MBTimeoutMargin;
+  u32Timeout = (_i32Srtt8 >> 3) + i32Margin;
+  _u16Timeout = u32Timeout < ku16MBResponseTimeout ? u32Timeout : ku16MBResponseTimeout;
+}
+
+
+/**
+Response timeout of a probe to an offline slave: the smoothed response
+time plus margin, or ku16MBProbeTimeout if the slave has never responded.
+Unlike the adaptive timeout this does not grow when probes go unanswered.
+*/
+uint16_t ModbusMaster::probeTimeout()
+{
+  uint32_t u32Timeout = ku16MBProbeTimeout;
+
+  if (_i32Srtt8 >= 0)
+  {
+    u32Timeout = (_i32Srtt8 >> 3) + ku16MBTimeoutMargin;
+  }
+  return u32Timeout < ku16MBResponseTimeout ? u32Timeout : ku16MBResponseTimeout;
+}
+
+
+/**
+Receive interrupt hook. Feeds the response frame assembler and wakes up
+the waiting task when the frame is complete. Every character restarts the
+gap timer; a gap longer than 1.5 character times ends the frame as
+invalid.
+*/
+void ModbusMaster::rxHook(void *arg, uint8_t c, portBASE_TYPE *hpw)
+{
+  ModbusMaster *mb = static_cast<ModbusMaster *>(arg);
+  bool done;
+
+  if (mb->_gapTimer->restart())
+  {
+    done = mb->_rx.feed(c);
+  }
+  else
+  {
+    done = mb->_rx.gapError();
+  }
+
+  if (done && mb->_waiter)
+  {
+    vTaskNotifyGiveFromISR(mb->_waiter, hpw);
+  }
+}
+
+
+/**
+Gap timer hook. Called when 3.5 character times have passed since the
+last received character, which ends the response frame.
+*/
+void ModbusMaster::gapExpired(void *arg, portBASE_TYPE *hpw)
+{
+  ModbusMaster *mb = static_cast<ModbusMaster *>(arg);
+
+  if (mb->_rx.endOfFrame() && mb->_waiter)
+  {
+    vTaskNotifyGiveFromISR(mb->_waiter, hpw);
+  }
+}
+
+
+/**
+Line error hook. A framing, parity, noise or overrun error or a break in
+the middle of the response ends the frame as invalid right away instead
+of waiting for the response timeout.
+*/
+void ModbusMaster::lineError(void *arg, uint32_t errors, portBASE_TYPE *hpw)
+{
+  ModbusMaster *mb = static_cast<ModbusMaster *>(arg);
+  (void) errors;
+
+  if (mb->_rx.lineError() && mb->_waiter)
+  {
+    vTaskNotifyGiveFromISR(mb->_waiter, hpw);
+  }
+}
+
+
+/**
+Assemble the request ADU, arm the receiver and transmit the request.
+Returns as soon as the request has been queued for transmission.
+
+@param u8MBFunction Modbus function (0x01..0xFF)
+@return 0 on success; exception number on failure
+*/
+uint8_t ModbusMaster::startTransaction(uint8_t u8MBFunction)
 {
   uint8_t u8ModbusADU[256];
   uint8_t u8ModbusADUSize = 0;
   uint8_t i, u8Qty;
   uint16_t u16CRC;
-  uint32_t u32StartTime;
-  uint8_t u8BytesLeft = 8;
-  uint8_t u8MBStatus = ku8MBSuccess;
+
+  if (_pending)
+  {
+    return ku8MBTransactionPending;
+  }
 
   // assemble Modbus Request Application Data Unit
   u8ModbusADU[u8ModbusADUSize++] = _u8MBSlave;
@@ -753,130 +1248,100 @@ uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction)
   }
 
   // append CRC
-  u16CRC = 0xFFFF;
-  for (i = 0; i < u8ModbusADUSize; i++)
-  {
-    u16CRC = crc16_update(u16CRC, u8ModbusADU[i]);
-  }
+  u16CRC = ModbusCrc::compute(u8ModbusADU, u8ModbusADUSize);
   u8ModbusADU[u8ModbusADUSize++] = lowByte(u16CRC);
   u8ModbusADU[u8ModbusADUSize++] = highByte(u16CRC);
   u8ModbusADU[u8ModbusADUSize] = 0;
 
   // flush receive buffer before transmitting request
-  while (MBSerial->read() != -1);
+  uint8_t u8Discard[16];
+  while (MBSerial->readFrame(u8Discard, sizeof(u8Discard), millis(), 0) > 0)
+  {
+  }
 
-#if 0
-  // transmit request
-  for (i = 0; i < u8ModbusADUSize; i++)
+  _u8MBFunction = u8MBFunction;
+  _u8MBStatus = ku8MBSuccess;
+
+  // broadcast is not answered: the transaction is complete when the request has been sent
+  if (_u8MBSlave == 0)
   {
-#if defined(ARDUINO) && ARDUINO >= 100
-    MBSerial->write(u8ModbusADU[i]);
-#else
-    MBSerial->print(u8ModbusADU[i], BYTE);
-#endif
+    MBSerial->write((char *)u8ModbusADU, u8ModbusADUSize);
+    MBSerial->flush();
+    return ku8MBSuccess;
   }
-#else
-  MBSerial->write((char *)u8ModbusADU, u8ModbusADUSize);
-#endif
-  //printf("TX: %02X\n", u8ModbusADU[0]);
-  u8ModbusADUSize = 0;
-  MBSerial->flush();    // flush transmit buffer
 
-  // loop until we run out of time or bytes, or an error occurs
-  u32StartTime = millis();
-  while (u8BytesLeft && !u8MBStatus)
+  // with a gap timer response bytes go directly from the receive interrupt to the frame
+  // assembler, otherwise the waiting task reads them in frames that end with silence
+  _rx.arm(_u8MBSlave, u8MBFunction, true);
+  if (_gapTimer)
   {
-    if (MBSerial->available())
-    {
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(4, true);
-#endif
-      u8ModbusADU[u8ModbusADUSize++] = MBSerial->read();
-      u8BytesLeft--;
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(4, false);
-#endif
-    }
-    else
-    {
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(5, true);
-#endif
-      if (_idle)
-      {
-        _idle();
-      }
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(5, false);
-#endif
-    }
+    _gapTimer->attach(gapExpired, this);
+    MBSerial->setRxHook(rxHook, this);
+  }
+  MBSerial->setErrorHook(lineError, this);
+  _pending = true;
+  _u16WaitTimeout = _u16Timeout;
+  _u32StartTime = millis();
+  _u32StartCycles = ModbusStats::cycles();
 
-    // evaluate slave ID, function code once enough bytes have been read
-    if (u8ModbusADUSize == 5)
-    {
-      // verify response is for correct Modbus slave
-      if (u8ModbusADU[0] != _u8MBSlave)
-      {
-        u8MBStatus = ku8MBInvalidSlaveID;
-        break;
-      }
+  MBSerial->write((char *)u8ModbusADU, u8ModbusADUSize);
+  //printf("TX: %02X\n", u8ModbusADU[0]);
 
-      // verify response is for correct Modbus function code (mask exception bit 7)
-      if ((u8ModbusADU[1] & 0x7F) != u8MBFunction)
-      {
-        u8MBStatus = ku8MBInvalidFunction;
-        break;
-      }
+  return ku8MBSuccess;
+}
 
-      // check whether Modbus exception occurred; return Modbus Exception Code
-      if (bitRead(u8ModbusADU[1], 7))
-      {
-        u8MBStatus = u8ModbusADU[2];
-        break;
-      }
 
-      // evaluate returned Modbus function code
-      switch(u8ModbusADU[1])
-      {
-        case ku8MBReadCoils:
-        case ku8MBReadDiscreteInputs:
-        case ku8MBReadInputRegisters:
-        case ku8MBReadHoldingRegisters:
-        case ku8MBReadWriteMultipleRegisters:
-          u8BytesLeft = u8ModbusADU[2];
-          break;
+/**
+Release the receiver and evaluate the received response.
 
-        case ku8MBWriteSingleCoil:
-        case ku8MBWriteMultipleCoils:
-        case ku8MBWriteSingleRegister:
-        case ku8MBWriteMultipleRegisters:
-          u8BytesLeft = 3;
-          break;
+@return 0 on success; exception number on failure
+*/
+uint8_t ModbusMaster::finishTransaction()
+{
+  const uint8_t *u8ModbusADU = _rx.data();
+  uint8_t u8ModbusADUSize = _rx.size();
+  uint8_t u8MBFunction = _u8MBFunction;
+  uint8_t u8MBStatus = ku8MBSuccess;
+  uint8_t i;
 
-        case ku8MBMaskWriteRegister:
-          u8BytesLeft = 5;
-          break;
-      }
+  MBSerial->setRxHook(NULL, NULL);
+  MBSerial->setErrorHook(NULL, NULL);
+  if (_gapTimer) _gapTimer->attach(NULL, NULL);
+  _pending = false;
+
+  if (!_rx.done())
+  {
+    u8MBStatus = ku8MBResponseTimedOut;
+  }
+  else if (_rx.state() == ModbusRtuReceiver::invalid || u8ModbusADUSize < 5)
+  {
+    u8MBStatus = ku8MBInvalidFrame;
+  }
+  else
+  {
+    // verify response is for correct Modbus slave
+    if (u8ModbusADU[0] != _u8MBSlave)
+    {
+      u8MBStatus = ku8MBInvalidSlaveID;
+    }
+    // verify response is for correct Modbus function code (mask exception bit 7)
+    else if ((u8ModbusADU[1] & 0x7F) != u8MBFunction)
+    {
+      u8MBStatus = ku8MBInvalidFunction;
     }
-    if ((millis() - u32StartTime) > ku16MBResponseTimeout)
+    // check whether Modbus exception occurred; return Modbus Exception Code
+    else if (bitRead(u8ModbusADU[1], 7))
     {
-      u8MBStatus = ku8MBResponseTimedOut;
+      u8MBStatus = u8ModbusADU[2];
     }
   }
+  _rx.disarm();
 
   // verify response is large enough to inspect further
   if (!u8MBStatus && u8ModbusADUSize >= 5)
   {
-    // calculate CRC
-    u16CRC = 0xFFFF;
-    for (i = 0; i < (u8ModbusADUSize - 2); i++)
-    {
-      u16CRC = crc16_update(u16CRC, u8ModbusADU[i]);
-    }
-
     // verify CRC
-    if (!u8MBStatus && (lowByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 2] ||
-      highByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 1]))
+    if (!ModbusCrc::verify(u8ModbusADU, u8ModbusADUSize))
     {
       u8MBStatus = ku8MBInvalidCRC;
     }
@@ -916,6 +1381,15 @@ uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction)
       case ku8MBReadInputRegisters:
       case ku8MBReadHoldingRegisters:
       case ku8MBReadWriteMultipleRegisters:
+        // decode directly from the frame if a register map is waiting for the response
+        if (_decodeMap)
+        {
+          if (!_decodeMap->decode(u8ModbusADU + 3, _u16ReadAddress, u8ModbusADU[2] >> 1, _decodeDest))
+          {
+            u8MBStatus = ku8MBDecodeError;
+          }
+          break;
+        }
         // load bytes into word; response bytes are ordered H, L, H, L, ...
         for (i = 0; i < (u8ModbusADU[2] >> 1); i++)
         {
@@ -933,5 +1407,17 @@ uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction)
   _u8TransmitBufferIndex = 0;
   u16TransmitBufferLength = 0;
   _u8ResponseBufferIndex = 0;
+  _u8MBStatus = u8MBStatus;
+  ModbusStats::record(_u8MBSlave, u8MBStatus, _u32StartCycles);
+  if (!retryable(u8MBStatus))
+  {
+    updateTimeout(millis() - _u32StartTime);
+  }
+  else if (u8MBStatus == ku8MBResponseTimedOut && _u16WaitTimeout == _u16Timeout)
+  {
+    // the slave may just have become slower: back off until it answers again.
+    // A shortened wait says nothing about the response time of the slave
+    _u16Timeout = _u16Timeout < ku16MBResponseTimeout / 2 ? _u16Timeout * 2 : ku16MBResponseTimeout;
+  }
   return u8MBStatus;
 }
@@ -74,6 +74,10 @@ Set to 1 to enable debugging features within class:
 
 
 #include "SerialPort.h"
+#include "ModbusRtuReceiver.h"
+#include "ModbusGapTimer.h"
+#include "ModbusMap.h"
+#include "ModbusStats.h"
 
 /* _____CLASS DEFINITIONS____________________________________________________ */
 /**
@@ -86,9 +90,12 @@ class ModbusMaster
     ModbusMaster();
     ModbusMaster(uint8_t);
     ModbusMaster(uint8_t, uint8_t);
+    ModbusMaster(uint8_t, SerialPort *);
 
     void begin();
-    void begin(uint16_t);
+    void begin(uint32_t);
+    void begin(const SerialPortConfig &);
+    uint32_t baudRate();
     void idle(void (*)());
 
     // Modbus exception codes
@@ -203,6 +210,48 @@ class ModbusMaster
     */
     static const uint8_t ku8MBInvalidCRC                 = 0xE3;
 
+    /**
+    ModbusMaster transaction pending exception.
+
+    A new transaction was started before the previous one on the same
+    object was completed with ModbusMaster::wait().
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBTransactionPending         = 0xE4;
+
+    /**
+    ModbusMaster invalid response frame exception.
+
+    The response was corrupt: more than 1.5 character times passed between
+    two characters, or 3.5 character times of silence ended the frame
+    before the announced length was received.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBInvalidFrame               = 0xE5;
+
+    /**
+    ModbusMaster slave offline exception.
+
+    The slave has failed repeatedly and is skipped without a transaction
+    until the next probe.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBSlaveOffline               = 0xE6;
+
+    /**
+    ModbusMaster decode error exception.
+
+    The response was valid but had fewer registers than the register map
+    needs. The destination of ModbusMaster::readRegisters() is left
+    unchanged. Not retried since the slave would answer the same way.
+
+    @ingroup constant
+    */
+    static const uint8_t ku8MBDecodeError                = 0xE7;
+
     uint16_t getResponseBuffer(uint8_t);
     void     clearResponseBuffer();
     uint8_t  setTransmitBuffer(uint8_t, uint16_t);
@@ -232,10 +281,25 @@ class ModbusMaster
     uint8_t  readWriteMultipleRegisters(uint16_t, uint16_t, uint16_t, uint16_t);
     uint8_t  readWriteMultipleRegisters(uint16_t, uint16_t);
 
+    // read the registers of a map and decode them into dest without the response buffer
+    uint8_t  readRegisters(const ModbusMap &, void *);
+
+    // asynchronous transactions; complete with poll()/wait()
+    uint8_t  startReadHoldingRegisters(uint16_t, uint16_t);
+    uint8_t  startReadInputRegisters(uint16_t, uint8_t);
+    uint8_t  startWriteSingleRegister(uint16_t, uint16_t);
+    bool     poll();
+    uint8_t  wait();
+    uint8_t  wait(uint16_t);
+
+    // slave health
+    bool     online();
+    uint16_t responseTimeout();
+
   private:
     uint8_t  _u8SerialPort;                                      ///< serial port (0..3) initialized in constructor
     uint8_t  _u8MBSlave;                                         ///< Modbus slave (1..255) initialized in constructor
-    uint16_t _u16BaudRate;                                       ///< baud rate (300..115200) initialized in begin()
+    uint32_t _u32BaudRate;                                       ///< baud rate (300..115200) initialized in begin()
     static const uint8_t ku8MaxBufferSize                = 64;   ///< size of response/transmit buffers
     uint16_t _u16ReadAddress;                                    ///< slave register from which to read
     uint16_t _u16ReadQty;                                        ///< quantity of words to read
@@ -249,6 +313,8 @@ class ModbusMaster
     uint16_t* rxBuffer; // from Wire.h -- need to clean this up Rx
     uint8_t _u8ResponseBufferIndex;
     uint8_t _u8ResponseBufferLength;
+    const ModbusMap *_decodeMap = nullptr;                       ///< map that receives the next register response instead of the response buffer
+    void *_decodeDest = nullptr;
 
     // Modbus function codes for bit access
     static const uint8_t ku8MBReadCoils                  = 0x01; ///< Modbus function 0x01 Read Coils
@@ -265,14 +331,50 @@ class ModbusMaster
     static const uint8_t ku8MBReadWriteMultipleRegisters = 0x17; ///< Modbus function 0x17 Read Write Multiple Registers
 
     // Modbus timeout [milliseconds]
-    static const uint16_t ku16MBResponseTimeout          = 2000; ///< Modbus timeout [milliseconds]
+    static const uint16_t ku16MBResponseTimeout          = 2000; ///< Modbus timeout [milliseconds], upper limit of the adaptive timeout
+    static const uint16_t ku16MBInitialTimeout           = 200;  ///< timeout until the first response has been measured [milliseconds]
+    static const uint16_t ku16MBProbeTimeout             = 100;  ///< timeout of probes to a slave that has never responded [milliseconds]
+    static const uint16_t ku16MBTimeoutMargin            = 50;   ///< minimum margin above the smoothed response time [milliseconds]
+    static const uint16_t ku16MBTurnaroundDelay          = 100;  ///< delay after a broadcast [milliseconds]
+
+    // retry policy
+    static const uint8_t ku8MBMaxRetries                 = 2;    ///< retries after a failed transaction
+    static const uint16_t ku16MBRetryBackoffBase         = 10;   ///< first retry backoff [milliseconds]
+    static const uint16_t ku16MBRetryBackoffMax          = 200;  ///< maximum retry backoff [milliseconds]
+    static const uint8_t ku8MBOfflineThreshold           = 3;    ///< failed attempts in a row before the slave is taken offline
+    static const uint16_t ku16MBProbeInterval            = 10000; ///< interval of probes to an offline slave [milliseconds]
 
     // master function that conducts Modbus transactions
     uint8_t ModbusMasterTransaction(uint8_t u8MBFunction);
+    uint8_t startTransaction(uint8_t u8MBFunction);
+    uint8_t finishTransaction();
+    void receive(TickType_t);
+    void updateTimeout(uint32_t u32ResponseTime);
+    uint16_t probeTimeout();
+    static bool retryable(uint8_t u8MBStatus);
+    static void rxHook(void *arg, uint8_t c, portBASE_TYPE *hpw);
+    static void gapExpired(void *arg, portBASE_TYPE *hpw);
+    static void lineError(void *arg, uint32_t errors, portBASE_TYPE *hpw);
+
+    ModbusRtuReceiver _rx;                                       ///< response frame assembler fed by the receive interrupt
+    uint8_t _u8MBFunction = 0;                                   ///< function code of the transaction in progress
+    uint8_t _u8MBStatus = ku8MBSuccess;                          ///< status of the last completed transaction
+    bool _pending = false;                                       ///< set while a transaction is in progress
+    uint32_t _u32StartTime = 0;                                  ///< tick count when the request was sent
+    uint32_t _u32StartCycles = 0;                                ///< cycle counter when the request was sent, for statistics
+    TaskHandle_t volatile _waiter = NULL;                        ///< task to notify when the response is complete
+    uint16_t _u16Timeout = ku16MBInitialTimeout;                 ///< adaptive response timeout [milliseconds]
+    uint16_t _u16WaitTimeout = ku16MBInitialTimeout;             ///< response timeout of the transaction in progress [milliseconds]
+    int32_t _i32Srtt8 = -1;                                      ///< smoothed response time * 8, negative until the first response
+    int32_t _i32Rttvar4 = 0;                                     ///< response time variation * 4
+    uint8_t _u8Failures = 0;                                     ///< failed attempts in a row
+    bool _offline = false;                                       ///< set when the slave is skipped
+    uint32_t _u32OfflineSince = 0;                               ///< tick count of going offline or of the last probe
 
     // idle callback function; gets called during idle time between TX and RX
     void (*_idle)();
     SerialPort *MBSerial = NULL; // added by KRL
+    ModbusGapTimer *_gapTimer = NULL;                           ///< frame timing of the bus, NULL if the bus has none
 };
 #endif
 
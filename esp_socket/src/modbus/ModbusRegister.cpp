@@ -26,9 +26,9 @@ int ModbusRegister::read() {
 	return -1;
 }
 
-void ModbusRegister::write(int value)
+bool ModbusRegister::write(int value)
 {
-	// write only if not
-	if(hr) m->writeSingleRegister(addr, value); // not checking if write succeeds
-
+	// input registers are read only
+	if(!hr) return false;
+	return m->writeSingleRegister(addr, value) == m->ku8MBSuccess;
 }
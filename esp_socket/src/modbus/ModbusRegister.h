@@ -16,7 +16,7 @@ public:
 	ModbusRegister(const ModbusRegister &)  = delete;
 	virtual ~ModbusRegister();
 	int read();
-	void write(int value);
+	bool write(int value); /* returns true if the slave accepted the value */
 private:
 	ModbusMaster *m;
 	int addr;
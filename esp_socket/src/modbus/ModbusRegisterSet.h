@@ -0,0 +1,154 @@
+/*
+ * ModbusRegisterSet.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Compile-time register maps. A register is described by a type:
+ *
+ *    struct Temperature : ModbusReg<257, ModbusField::int16, 10> {
+ *        static const char *unit() { return "C"; }
+ *    };
+ *
+ *  and a device by the list of its registers in ascending address order:
+ *
+ *    ModbusRegisterSet<Humidity, Temperature> values(&node);
+ *    values.read();
+ *    float t = values.get<Temperature>();
+ *
+ *  The field table and the grouping of registers into block reads are
+ *  constant expressions so they live in flash and read() performs the
+ *  minimum number of transactions without building anything at run time.
+ */
+
+#ifndef MODBUSREGISTERSET_H_
+#define MODBUSREGISTERSET_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <type_traits>
+#include "ModbusMaster.h"
+#include "ModbusMap.h"
+
+/* Register description. Divisor is applied to the raw value, scaled values are read as float */
+template<uint16_t Address, ModbusField::Type Type = ModbusField::int16, int Divisor = 1,
+		ModbusField::Order Order = ModbusField::highFirst>
+struct ModbusReg {
+	static constexpr uint16_t address = Address;
+	static constexpr ModbusField::Type type = Type;
+	static constexpr ModbusField::Order order = Order;
+	static constexpr int divisor = Divisor;
+	static constexpr int words = (Type >= ModbusField::int32) ? 2 : 1;
+	static const char *unit() { return ""; }
+};
+
+/* C type of an unscaled register value */
+template<ModbusField::Type T> struct ModbusNative;
+template<> struct ModbusNative<ModbusField::int16> { typedef int16_t type; };
+template<> struct ModbusNative<ModbusField::uint16> { typedef uint16_t type; };
+template<> struct ModbusNative<ModbusField::int32> { typedef int32_t type; };
+template<> struct ModbusNative<ModbusField::uint32> { typedef uint32_t type; };
+template<> struct ModbusNative<ModbusField::float32> { typedef float type; };
+
+/* C type that get() returns for a register */
+template<typename R> struct ModbusValue {
+	typedef typename std::conditional<R::divisor != 1, float, typename ModbusNative<R::type>::type>::type type;
+};
+
+/* Position of a register type in a register list */
+template<typename R, typename... Regs> struct ModbusIndexOf;
+template<typename R, typename... Regs> struct ModbusIndexOf<R, R, Regs...> {
+	static constexpr int value = 0;
+};
+template<typename R, typename First, typename... Regs> struct ModbusIndexOf<R, First, Regs...> {
+	static constexpr int value = 1 + ModbusIndexOf<R, Regs...>::value;
+};
+template<typename R> struct ModbusIndexOf<R> {
+	static_assert(sizeof(R) == 0, "register is not in the register set");
+	static constexpr int value = 0;
+};
+
+/* Block layout of a register list. Registers are read in the same block as the previous
+ * register if the gap between them and the total span of the block are small enough */
+template<typename... Regs>
+struct ModbusLayout {
+	static constexpr int Count = sizeof...(Regs);
+	static constexpr int MaxGap = 4;    /* unused registers that may be read to join two blocks */
+	static constexpr int MaxSpan = 125; /* Modbus limit for one read */
+
+	static constexpr uint16_t addr[Count] = { Regs::address... };
+	static constexpr uint16_t last[Count] = { Regs::address + Regs::words... }; /* one past the register */
+
+	static constexpr bool sorted(int i) {
+		return i + 1 >= Count || (last[i] <= addr[i + 1] && sorted(i + 1));
+	}
+	static constexpr int join(int i, int start) {
+		return (addr[i] - last[i - 1] <= MaxGap && last[i] - addr[start] <= MaxSpan) ? start : i;
+	}
+	static constexpr int startOf(int i) { /* index of the first register in the block of register i */
+		return i == 0 ? 0 : join(i, startOf(i - 1));
+	}
+	static constexpr int blocks(int i = 0) {
+		return i >= Count ? 0 : (startOf(i) == i ? 1 : 0) + blocks(i + 1);
+	}
+};
+
+template<typename... Regs> constexpr uint16_t ModbusLayout<Regs...>::addr[];
+template<typename... Regs> constexpr uint16_t ModbusLayout<Regs...>::last[];
+
+/* Field of a register that is stored in slot index. Each slot is four bytes which is large enough for any register type */
+template<typename R> constexpr ModbusField modbusField(int index) {
+	return ModbusField { R::address, R::type, R::order, (float) R::divisor, (uint16_t) (index * sizeof(uint32_t)) };
+}
+
+template<typename... Regs>
+class ModbusRegisterSet {
+public:
+	typedef ModbusLayout<Regs...> Layout;
+	static constexpr int Count = sizeof...(Regs);
+	static_assert(Layout::sorted(0), "registers must be listed in ascending address order without overlap");
+
+	ModbusRegisterSet(ModbusMaster *master, bool holdingRegister = true)
+		: m(master), hr(holdingRegister), ok(false) {
+		memset(values, 0, sizeof(values));
+	}
+	ModbusRegisterSet(const ModbusRegisterSet &) = delete;
+
+	/* read all registers, one transaction per block. Returns true if all blocks were read */
+	bool read() {
+		bool result = true;
+		for(int i = 0; i < Count; ) {
+			int end = i + 1;
+			while(end < Count && blockStart[end] == i) ++end;
+			ModbusMap map(fields + i, end - i, hr);
+			if(m->readRegisters(map, values) != m->ku8MBSuccess) result = false;
+			i = end;
+		}
+		ok = result;
+		return ok;
+	}
+
+	bool valid() const { return ok; }
+
+	/* value of a register from the last read */
+	template<typename R> typename ModbusValue<R>::type get() const {
+		typename ModbusValue<R>::type v;
+		memcpy(&v, &values[ModbusIndexOf<R, Regs...>::value], sizeof(v));
+		return v;
+	}
+
+	static constexpr int blocks() { return Layout::blocks(); } /* number of transactions per read() */
+
+private:
+	static constexpr ModbusField fields[Count] = { modbusField<Regs>(ModbusIndexOf<Regs, Regs...>::value)... };
+	static constexpr uint8_t blockStart[Count] = { (uint8_t) Layout::startOf(ModbusIndexOf<Regs, Regs...>::value)... };
+
+	ModbusMaster *m;
+	bool hr;
+	bool ok;
+	uint32_t values[Count];
+};
+
+template<typename... Regs> constexpr ModbusField ModbusRegisterSet<Regs...>::fields[];
+template<typename... Regs> constexpr uint8_t ModbusRegisterSet<Regs...>::blockStart[];
+
+#endif /* MODBUSREGISTERSET_H_ */
@@ -0,0 +1,94 @@
+/*
+ * ModbusRtuReceiver.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include "ModbusRtuReceiver.h"
+
+ModbusRtuReceiver::ModbusRtuReceiver()
+	: st(idle), slave(0), function(0), len(0), expected(0), gap(false) {
+}
+
+void ModbusRtuReceiver::arm(uint8_t slave_, uint8_t function_, bool gapTimed) {
+	st = idle; // feed() ignores bytes while we set up
+	slave = slave_;
+	function = function_;
+	len = 0;
+	expected = 0;
+	gap = gapTimed;
+	st = receiving;
+}
+
+void ModbusRtuReceiver::disarm() {
+	st = idle;
+}
+
+/* Total length of the response frame (including CRC) as determined from the
+ * first five bytes. Returns zero if the length is not known, in which case
+ * the frame ends with the t3.5 gap or, without a gap timer, right away so
+ * that the master can report the error without waiting for the timeout. */
+int ModbusRtuReceiver::frameLength() const {
+	// wrong slave or wrong function: let the gap tell where the frame ends
+	if(adu[0] != slave || (adu[1] & 0x7F) != function) return gap ? 0 : 5;
+	// exception response
+	if(adu[1] & 0x80) return 5;
+
+	switch(adu[1]) {
+	case 0x01: // read coils
+	case 0x02: // read discrete inputs
+	case 0x03: // read holding registers
+	case 0x04: // read input registers
+	case 0x17: // read write multiple registers
+		return 5 + adu[2];
+	case 0x05: // write single coil
+	case 0x06: // write single register
+	case 0x0F: // write multiple coils
+	case 0x10: // write multiple registers
+		return 8;
+	case 0x16: // mask write register
+		return 10;
+	default:
+		return gap ? 0 : 5;
+	}
+}
+
+bool ModbusRtuReceiver::feed(uint8_t c) {
+	if(st != receiving) return false;
+
+	if(len >= MaxFrameSize) {
+		st = overflow;
+		return true;
+	}
+
+	adu[len++] = c;
+	if(len == 5) expected = frameLength();
+	if(expected && len >= expected) {
+		st = complete;
+		return true;
+	}
+	return false;
+}
+
+bool ModbusRtuReceiver::endOfFrame() {
+	if(st != receiving || len == 0) return false;
+
+	// a frame that ends before its announced length is a partial frame
+	st = (expected && len < expected) ? invalid : complete;
+	return true;
+}
+
+bool ModbusRtuReceiver::gapError() {
+	if(st != receiving || len == 0) return false;
+
+	st = invalid;
+	return true;
+}
+
+bool ModbusRtuReceiver::lineError() {
+	// errors before the response starts are driver turnaround glitches
+	if(st != receiving || len == 0) return false;
+
+	st = invalid;
+	return true;
+}
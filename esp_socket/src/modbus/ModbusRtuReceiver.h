@@ -0,0 +1,53 @@
+/*
+ * ModbusRtuReceiver.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Assembles a Modbus RTU response one byte at a time. feed() is called
+ *  from the UART receive interrupt and does not use any RTOS services so
+ *  the class can also be driven by a simulated slave on a host build.
+ *
+ *  When a gap timer is used the frame is delimited by 3.5 character times
+ *  of silence (endOfFrame()) which also allows replies of unknown length.
+ *  Known reply lengths still complete the frame on the last character.
+ */
+
+#ifndef MODBUSRTURECEIVER_H_
+#define MODBUSRTURECEIVER_H_
+
+#include <stdint.h>
+
+class ModbusRtuReceiver {
+public:
+	enum State {
+		idle,      /* not expecting a response */
+		receiving, /* armed, waiting for (the rest of) the frame */
+		complete,  /* expected number of bytes received or frame ended by silence */
+		overflow,  /* frame did not fit in the buffer */
+		invalid    /* character gap exceeded t1.5, line error or frame ended before expected length */
+	};
+	static const int MaxFrameSize = 256;
+
+	ModbusRtuReceiver();
+	void arm(uint8_t slave, uint8_t function, bool gapTimed = false); /* start waiting for a response to the given request */
+	void disarm();
+	bool feed(uint8_t c); /* add a received byte. Returns true when the frame is done */
+	bool endOfFrame(); /* t3.5 silence detected. Returns true if this ended the frame */
+	bool gapError(); /* t1.5 exceeded between characters. Returns true if this ended the frame */
+	bool lineError(); /* framing, parity, noise, overrun or break on the line. Returns true if this ended the frame */
+	State state() const { return st; }
+	bool done() const { return st == complete || st == overflow || st == invalid; }
+	const uint8_t *data() const { return adu; }
+	int size() const { return len; }
+private:
+	int frameLength() const;
+	volatile State st;
+	uint8_t slave;
+	uint8_t function;
+	volatile int len;
+	int expected;
+	bool gap;
+	uint8_t adu[MaxFrameSize];
+};
+
+#endif /* MODBUSRTURECEIVER_H_ */
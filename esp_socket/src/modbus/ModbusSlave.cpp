@@ -0,0 +1,213 @@
+/*
+ * ModbusSlave.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include <cstring>
+#include "ModbusSlave.h"
+#include "ModbusCrc.h"
+#include "ModbusStats.h"
+
+ModbusSlave::ModbusSlave(LpcUart *uart, uint8_t address, uint16_t firstRegister, int count_, uint32_t bps,
+		UBaseType_t priority)
+	: u(uart), addr(address), first(firstRegister), count(count_), writeFirst(0), writeCount(0),
+	  handle(nullptr), len(0), size(0), lastChar(0), ready(false), version(0) {
+	if(count > MaxRegisters) count = MaxRegisters;
+	memset(table, 0, sizeof(table));
+
+	// t3.5 silence separates frames. Fixed 1750 us above 19200 bps as in the specification
+	ModbusStats::begin();
+	uint32_t us = bps > 19200 ? 1750 : (35 * 11 * 100000) / bps;
+	gapCycles = us * (SystemCoreClock / 1000000);
+
+	writes = xQueueCreate(MaxWrites, sizeof(Write));
+	// stack must hold a request and a response frame
+	xTaskCreate(task, "mbslave", configMINIMAL_STACK_SIZE * 3 + MaxFrameSize / sizeof(StackType_t), this, priority,
+			&handle);
+	// requests are assembled in the receive interrupt: a port that receives with DMA can't be used
+	bool hooked = u->set_rx_hook(rxHook, this);
+	configASSERT(hooked);
+	(void) hooked;
+}
+
+ModbusSlave::~ModbusSlave() {
+	u->set_rx_hook(nullptr, nullptr);
+	if(handle) vTaskDelete(handle);
+	vQueueDelete(writes);
+}
+
+void ModbusSlave::setWritable(uint16_t first_, int count_) {
+	writeFirst = first_;
+	writeCount = count_;
+}
+
+bool ModbusSlave::contains(uint16_t address, int n) const {
+	return address >= first && address + n <= first + count;
+}
+
+bool ModbusSlave::update(uint16_t address, const uint16_t *values, int n) {
+	if(!contains(address, n)) return false;
+
+	// fill the copy that is not in use and make it current
+	uint32_t next = version.load(std::memory_order_relaxed) + 1;
+	uint16_t *dst = table[next & 1];
+	memcpy(dst, table[(next - 1) & 1], sizeof(table[0]));
+	memcpy(dst + (address - first), values, n * sizeof(uint16_t));
+	version.store(next, std::memory_order_release);
+	return true;
+}
+
+bool ModbusSlave::update(uint16_t address, uint16_t value) {
+	return update(address, &value, 1);
+}
+
+void ModbusSlave::snapshot(uint16_t address, int n, uint16_t *values) {
+	uint32_t v;
+	do {
+		v = version.load(std::memory_order_acquire);
+		memcpy(values, table[v & 1] + (address - first), n * sizeof(uint16_t));
+		// a new update may have reused our copy while we were reading it.
+		// The fence keeps the copy from being moved after the check
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while(version.load(std::memory_order_acquire) != v);
+}
+
+bool ModbusSlave::receiveWrite(uint16_t &address, uint16_t &value, TickType_t timeout) {
+	Write w;
+	if(xQueueReceive(writes, &w, timeout) != pdTRUE) return false;
+	address = w.address;
+	value = w.value;
+	return true;
+}
+
+/* Length of the request in the receive buffer, zero if not known yet */
+int ModbusSlave::requestLength() const {
+	if(len < 2) return 0;
+
+	switch(frame[1]) {
+	case 0x10: // write multiple registers: length comes with the byte count
+		return len < 7 ? 0 : 9 + frame[6];
+	default:   // read and write single functions have a fixed length
+		return 8;
+	}
+}
+
+void ModbusSlave::rxHook(void *arg, uint8_t c, portBASE_TYPE *hpw) {
+	ModbusSlave *s = static_cast<ModbusSlave *>(arg);
+	uint32_t now = ModbusStats::cycles();
+
+	// the master waits for our answer so nothing should arrive while a request is served
+	if(s->ready) return;
+
+	// silence longer than t3.5 starts a new frame
+	if(s->len > 0 && now - s->lastChar > s->gapCycles) s->len = 0;
+	s->lastChar = now;
+
+	if(s->len >= MaxFrameSize) s->len = 0;
+	s->frame[s->len++] = c;
+
+	int expected = s->requestLength();
+	if(expected && s->len >= expected) {
+		s->size = s->len;
+		s->len = 0;
+		// requests to other slaves are just skipped
+		if(s->frame[0] == s->addr || s->frame[0] == 0) {
+			s->ready = true;
+			vTaskNotifyGiveFromISR(s->handle, hpw);
+		}
+	}
+}
+
+void ModbusSlave::task(void *pvParameters) {
+	static_cast<ModbusSlave *>(pvParameters)->serve();
+}
+
+void ModbusSlave::serve() {
+	uint8_t rsp[MaxFrameSize];
+
+	while(true) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if(!ready) continue;
+
+		int n = 0;
+		// frames with a bad CRC are not answered
+		if(ModbusCrc::verify(frame, size)) {
+			n = respond(frame, size, rsp);
+			// broadcasts are executed but not answered
+			if(frame[0] == 0) n = 0;
+		}
+		ready = false;
+
+		if(n > 0) {
+			uint16_t crc = ModbusCrc::compute(rsp, n);
+			rsp[n++] = crc & 0xFF;
+			rsp[n++] = crc >> 8;
+			u->write((const char *) rsp, n);
+		}
+	}
+}
+
+int ModbusSlave::exception(const uint8_t *req, uint8_t code, uint8_t *rsp) {
+	rsp[0] = addr;
+	rsp[1] = req[1] | 0x80;
+	rsp[2] = code;
+	return 3;
+}
+
+/* Execute a request and build the response without CRC. Returns the response length */
+int ModbusSlave::respond(const uint8_t *req, int n, uint8_t *rsp) {
+	uint16_t address = req[2] << 8 | req[3];
+	uint16_t qty = req[4] << 8 | req[5];
+
+	switch(req[1]) {
+	case 0x03: // read holding registers
+	case 0x04: // read input registers
+	{
+		if(qty < 1 || qty > 125) return exception(req, IllegalDataValue, rsp);
+		if(!contains(address, qty)) return exception(req, IllegalDataAddress, rsp);
+
+		uint16_t values[MaxRegisters];
+		snapshot(address, qty, values);
+		rsp[0] = addr;
+		rsp[1] = req[1];
+		rsp[2] = qty * 2;
+		for(int i = 0; i < qty; ++i) {
+			rsp[3 + 2 * i] = values[i] >> 8;
+			rsp[4 + 2 * i] = values[i] & 0xFF;
+		}
+		return 3 + qty * 2;
+	}
+	case 0x06: // write single register, qty is the value
+	{
+		if(address < writeFirst || address + 1 > writeFirst + writeCount) {
+			return exception(req, IllegalDataAddress, rsp);
+		}
+		// we are the only producer: the space can only grow before we send
+		if(uxQueueSpacesAvailable(writes) < 1) return exception(req, SlaveDeviceBusy, rsp);
+		Write w = { address, qty };
+		xQueueSend(writes, &w, 0);
+		memcpy(rsp, req, 6); // echo
+		return 6;
+	}
+	case 0x10: // write multiple registers
+	{
+		if(qty < 1 || qty > 123 || req[6] != qty * 2 || n != 9 + req[6]) {
+			return exception(req, IllegalDataValue, rsp);
+		}
+		if(address < writeFirst || address + qty > writeFirst + writeCount) {
+			return exception(req, IllegalDataAddress, rsp);
+		}
+		// all or nothing: the response tells the master that every register was written
+		if(uxQueueSpacesAvailable(writes) < qty) return exception(req, SlaveDeviceBusy, rsp);
+		for(int i = 0; i < qty; ++i) {
+			Write w = { (uint16_t) (address + i), (uint16_t) (req[7 + 2 * i] << 8 | req[8 + 2 * i]) };
+			xQueueSend(writes, &w, 0);
+		}
+		memcpy(rsp, req, 6); // address and quantity
+		return 6;
+	}
+	default:
+		return exception(req, IllegalFunction, rsp);
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ * ModbusSlave.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Modbus RTU slave (server) on an RS-485 port. Requests are assembled
+ *  character by character in the UART receive interrupt; a complete
+ *  request addressed to us wakes the slave task that answers from the
+ *  register table right away.
+ *  The port must not use DMA receive (dma_rx).
+ *
+ *  The register table is double buffered: the application publishes new
+ *  values with update() and the slave task reads a consistent snapshot
+ *  without locks (the read is retried if an update was published during
+ *  it). update() must be called from one task only.
+ *
+ *  Supported functions: 0x03 read holding registers, 0x04 read input
+ *  registers (same table), 0x06 write single register and 0x10 write
+ *  multiple registers. Writes are accepted only to the writable range
+ *  and are handed to the application through receiveWrite(). A write
+ *  request that does not fit in the write queue as a whole is answered with
+ *  the Slave Device Busy exception so that the master retries it.
+ */
+
+#ifndef MODBUSSLAVE_H_
+#define MODBUSSLAVE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "LpcUart.h"
+
+class ModbusSlave {
+public:
+	static const int MaxRegisters = 64;
+	static const int MaxFrameSize = 256;
+	static const int MaxWrites = 64; /* registers waiting for receiveWrite() */
+
+	ModbusSlave(LpcUart *uart, uint8_t address, uint16_t firstRegister, int count, uint32_t bps,
+			UBaseType_t priority = tskIDLE_PRIORITY + 3);
+	ModbusSlave(const ModbusSlave &) = delete;
+	virtual ~ModbusSlave();
+	void setWritable(uint16_t first, int count); /* range of registers that the master may write */
+	bool update(uint16_t address, const uint16_t *values, int count); /* publish register values */
+	bool update(uint16_t address, uint16_t value);
+	/* get the next register written by the master. Returns false on timeout */
+	bool receiveWrite(uint16_t &address, uint16_t &value, TickType_t timeout = 0);
+private:
+	struct Write {
+		uint16_t address;
+		uint16_t value;
+	};
+	static const uint8_t IllegalFunction = 0x01;
+	static const uint8_t IllegalDataAddress = 0x02;
+	static const uint8_t IllegalDataValue = 0x03;
+	static const uint8_t SlaveDeviceBusy = 0x06;
+
+	static void rxHook(void *arg, uint8_t c, portBASE_TYPE *hpw);
+	static void task(void *pvParameters);
+	void serve();
+	int requestLength() const;
+	int respond(const uint8_t *req, int size, uint8_t *rsp);
+	int exception(const uint8_t *req, uint8_t code, uint8_t *rsp);
+	bool contains(uint16_t address, int count) const;
+	void snapshot(uint16_t address, int count, uint16_t *values);
+
+	LpcUart *u;
+	uint8_t addr;
+	uint16_t first;
+	int count;
+	uint16_t writeFirst;
+	int writeCount;
+	uint32_t gapCycles;   // t3.5 in cycle counter ticks
+	TaskHandle_t handle;
+	QueueHandle_t writes;
+
+	// receive state, owned by the ISR while ready is false
+	uint8_t frame[MaxFrameSize];
+	int len;
+	int size;
+	uint32_t lastChar;
+	volatile bool ready;  // a complete request waits for the task
+
+	// register table: version selects the current copy
+	uint16_t table[2][MaxRegisters];
+	std::atomic<uint32_t> version;
+};
+
+#endif /* MODBUSSLAVE_H_ */
@@ -0,0 +1,180 @@
+/*
+ * ModbusStats.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "ModbusStats.h"
+#include "ModbusMaster.h"
+
+ModbusStats::Slave ModbusStats::slaves[MaxSlaves];
+int ModbusStats::count = 0;
+uint32_t ModbusStats::overflow = 0;
+
+void ModbusStats::begin() {
+	// same cycle counter setup as in LiquidCrystal delayMicroseconds
+	CoreDebug->DEMCR |= 1 << 24;
+	DWT->CTRL |= 1;
+}
+
+/* Must be called in a critical section */
+ModbusStats::Slave *ModbusStats::find(uint8_t slave) {
+	for(int i = 0; i < count; ++i) {
+		if(slaves[i].address == slave) return &slaves[i];
+	}
+	if(count >= MaxSlaves) return nullptr;
+
+	Slave *s = &slaves[count++];
+	memset(s, 0, sizeof(*s));
+	s->address = slave;
+	s->minUs = UINT32_MAX;
+	return s;
+}
+
+void ModbusStats::record(uint8_t slave, uint8_t status, uint32_t startCycles) {
+	uint32_t us = (cycles() - startCycles) / (SystemCoreClock / 1000000);
+	int bucket = us < 256 ? 0 : 31 - __CLZ(us) - 7;
+	if(bucket >= Buckets) bucket = Buckets - 1;
+
+	taskENTER_CRITICAL();
+	Slave *s = find(slave);
+	if(!s) ++overflow;
+	if(s) {
+		++s->transactions;
+		if(us < s->minUs) s->minUs = us;
+		if(us > s->maxUs) s->maxUs = us;
+		s->sumUs += us;
+		++s->histogram[bucket];
+
+		if(status != ModbusMaster::ku8MBSuccess) {
+			++s->errors;
+			s->lastError = status;
+			s->lastErrorTime = xTaskGetTickCount();
+			switch(status) {
+			case ModbusMaster::ku8MBResponseTimedOut:
+				++s->timeouts;
+				break;
+			case ModbusMaster::ku8MBInvalidCRC:
+				++s->crcErrors;
+				break;
+			case ModbusMaster::ku8MBInvalidSlaveID:
+			case ModbusMaster::ku8MBInvalidFunction:
+			case ModbusMaster::ku8MBInvalidFrame:
+				++s->frameErrors;
+				break;
+			default:
+				if(status < ModbusMaster::ku8MBInvalidSlaveID) ++s->exceptions;
+				break;
+			}
+		}
+	}
+	taskEXIT_CRITICAL();
+}
+
+void ModbusStats::retry(uint8_t slave) {
+	taskENTER_CRITICAL();
+	Slave *s = find(slave);
+	if(s) ++s->retries;
+	taskEXIT_CRITICAL();
+}
+
+bool ModbusStats::get(uint8_t slave, Slave &copy) {
+	bool found = false;
+
+	taskENTER_CRITICAL();
+	for(int i = 0; i < count; ++i) {
+		if(slaves[i].address == slave) {
+			copy = slaves[i];
+			found = true;
+			break;
+		}
+	}
+	taskEXIT_CRITICAL();
+	return found;
+}
+
+uint32_t ModbusStats::untracked() {
+	return overflow;
+}
+
+void ModbusStats::reset() {
+	taskENTER_CRITICAL();
+	count = 0;
+	overflow = 0;
+	taskEXIT_CRITICAL();
+}
+
+uint32_t ModbusStats::Slave::averageUs() const {
+	return transactions ? (uint32_t)(sumUs / transactions) : 0;
+}
+
+uint32_t ModbusStats::Slave::percentileUs(int percent) const {
+	uint32_t limit = (transactions * percent + 99) / 100;
+	uint32_t sum = 0;
+	for(int i = 0; i < Buckets; ++i) {
+		sum += histogram[i];
+		if(sum >= limit) {
+			uint32_t upper = 256u << i;
+			return upper < maxUs ? upper : maxUs;
+		}
+	}
+	return maxUs;
+}
+
+int ModbusStats::format(char *buffer, int size) {
+	int len = 0;
+	buffer[0] = '\0';
+
+	for(int i = 0; i < MaxSlaves && len < size; ++i) {
+		Slave s;
+		taskENTER_CRITICAL();
+		bool valid = i < count;
+		if(valid) s = slaves[i];
+		taskEXIT_CRITICAL();
+		if(!valid) break;
+
+		len += snprintf(buffer + len, size - len,
+				"Modbus %d: n=%lu err=%lu (to=%lu crc=%lu frm=%lu exc=%lu) retry=%lu last=0x%02X"
+				" us=%lu/%lu/%lu/%lu\r\n",
+				s.address, s.transactions, s.errors, s.timeouts, s.crcErrors, s.frameErrors, s.exceptions,
+				s.retries, s.lastError, s.transactions ? s.minUs : 0, s.averageUs(), s.maxUs, s.percentileUs(99));
+	}
+	if(overflow && len < size) {
+		len += snprintf(buffer + len, size - len, "Modbus: %lu transactions of untracked slaves\r\n",
+				(unsigned long) overflow);
+	}
+	return len < size ? len : size - 1;
+}
+
+int ModbusStats::formatJson(char *buffer, int size) {
+	// entries that don't fit are left out so that the result is always valid JSON
+	static const int Tail = 32; // room for the untracked count and the closing brackets
+	int len = snprintf(buffer, size, "{\"modbus\":[");
+
+	for(int i = 0; i < MaxSlaves && len < size - Tail; ++i) {
+		Slave s;
+		taskENTER_CRITICAL();
+		bool valid = i < count;
+		if(valid) s = slaves[i];
+		taskEXIT_CRITICAL();
+		if(!valid) break;
+
+		int n = snprintf(buffer + len, size - Tail - len,
+				"%s{\"slave\":%d,\"n\":%lu,\"errors\":%lu,\"timeouts\":%lu,\"crc\":%lu,\"frame\":%lu,"
+				"\"exceptions\":%lu,\"retries\":%lu,\"last_error\":%d,"
+				"\"min_us\":%lu,\"avg_us\":%lu,\"max_us\":%lu,\"p99_us\":%lu}",
+				i ? "," : "", s.address, s.transactions, s.errors, s.timeouts, s.crcErrors, s.frameErrors,
+				s.exceptions, s.retries, s.lastError, s.transactions ? s.minUs : 0, s.averageUs(), s.maxUs,
+				s.percentileUs(99));
+		if(n >= size - Tail - len) break;
+		len += n;
+	}
+	len += snprintf(buffer + len, size - len, "],\"untracked\":%lu}", (unsigned long) overflow);
+	return len < size ? len : size - 1;
+}
+
+extern "C" int modbus_stats_json(char *buffer, int size) {
+	return ModbusStats::formatJson(buffer, size);
+}
@@ -0,0 +1,78 @@
+/*
+ * ModbusStats.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Per-slave Modbus transaction statistics: result counters, retries,
+ *  last error and a latency histogram measured with the DWT cycle counter.
+ *  Statistics can be printed as text (debug UART) or as JSON for MQTT.
+ */
+
+#ifndef MODBUSSTATS_H_
+#define MODBUSSTATS_H_
+
+#include <stdint.h>
+
+/* Slaves that get statistics. Transactions of further slaves are only counted */
+#ifndef MODBUS_STATS_MAX_SLAVES
+#define MODBUS_STATS_MAX_SLAVES 32
+#endif
+
+#ifdef __cplusplus
+
+#include "chip.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+class ModbusStats {
+public:
+	static const int MaxSlaves = MODBUS_STATS_MAX_SLAVES;
+	static const int Buckets = 16; /* bucket i counts latencies below 256 << i microseconds */
+
+	struct Slave {
+		uint8_t address;
+		uint8_t lastError;         /* status code of the last failed transaction */
+		TickType_t lastErrorTime;  /* tick count of the last failed transaction */
+		uint32_t transactions;
+		uint32_t errors;
+		uint32_t timeouts;
+		uint32_t crcErrors;
+		uint32_t frameErrors;      /* invalid frame, wrong slave or function */
+		uint32_t exceptions;       /* exception response from the slave */
+		uint32_t retries;
+		uint32_t minUs;
+		uint32_t maxUs;
+		uint64_t sumUs;
+		uint32_t histogram[Buckets];
+
+		uint32_t averageUs() const;
+		uint32_t percentileUs(int percent) const; /* upper bound of the histogram bucket */
+	};
+
+	static void begin(); /* enable the cycle counter */
+	static uint32_t cycles() { return DWT->CYCCNT; }
+	static void record(uint8_t slave, uint8_t status, uint32_t startCycles);
+	static void retry(uint8_t slave);
+	static bool get(uint8_t slave, Slave &s); /* copy of the statistics of a slave */
+	static uint32_t untracked(); /* transactions of slaves that did not fit in the table */
+	static void reset();
+	static int format(char *buffer, int size); /* one line per slave, for the debug UART */
+	static int formatJson(char *buffer, int size); /* JSON object for MQTT */
+private:
+	static Slave *find(uint8_t slave);
+	static Slave slaves[MaxSlaves];
+	static int count;
+	static uint32_t overflow;
+};
+
+extern "C" {
+#endif
+
+/* C interface for publishing the statistics over MQTT */
+int modbus_stats_json(char *buffer, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODBUSSTATS_H_ */
@@ -0,0 +1,85 @@
+/*
+ * ModbusWriteBatch.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include "ModbusWriteBatch.h"
+
+ModbusWriteBatch::ModbusWriteBatch(ModbusMaster *master)
+	: m(master), count(0), sent(0) {
+}
+
+ModbusWriteBatch::~ModbusWriteBatch() {
+}
+
+int ModbusWriteBatch::add(uint16_t address, uint16_t value, Callback cb, void *arg) {
+	// a new batch starts when the previous one has been flushed
+	if(sent == count) clear();
+	if(count >= MaxWrites) return -1;
+
+	writes[count].address = address;
+	writes[count].value = value;
+	writes[count].status = m->ku8MBTransactionPending;
+	writes[count].cb = cb;
+	writes[count].arg = arg;
+	return count++;
+}
+
+int ModbusWriteBatch::flush() {
+	int order[MaxWrites];
+	int n = 0;
+	int failed = 0;
+
+	// sort pending writes by address, writes to the same register stay in the order they were added
+	for(int i = sent; i < count; ++i) {
+		int j = n++;
+		while(j > 0 && writes[order[j - 1]].address > writes[i].address) {
+			order[j] = order[j - 1];
+			--j;
+		}
+		order[j] = i;
+	}
+
+	for(int i = 0; i < n; ) {
+		// collect a run of consecutive registers
+		uint16_t start = writes[order[i]].address;
+		int qty = 0;
+		int end = i;
+		while(end < n) {
+			int offset = writes[order[end]].address - start;
+			if(offset > qty || offset >= MaxRun) break;
+			if(offset == qty) ++qty;
+			m->setTransmitBuffer(offset, writes[order[end]].value); // later value of a register overrides
+			++end;
+		}
+
+		// a single register is written with the shorter 0x06 request
+		uint8_t result = (qty == 1) ? m->writeSingleRegister(start, writes[order[end - 1]].value)
+				: m->writeMultipleRegisters(start, qty);
+
+		for(; i < end; ++i) {
+			Write &w = writes[order[i]];
+			w.status = result;
+			if(result != m->ku8MBSuccess) ++failed;
+			if(w.cb) w.cb(w.arg, w.address, result);
+		}
+	}
+
+	sent = count;
+	return failed;
+}
+
+uint8_t ModbusWriteBatch::status(int handle) const {
+	if(handle < 0 || handle >= count) return m->ku8MBIllegalDataAddress;
+	return writes[handle].status;
+}
+
+int ModbusWriteBatch::pending() const {
+	return count - sent;
+}
+
+void ModbusWriteBatch::clear() {
+	count = 0;
+	sent = 0;
+}
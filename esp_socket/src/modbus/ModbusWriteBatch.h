@@ -0,0 +1,51 @@
+/*
+ * ModbusWriteBatch.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Collects register writes to one slave and sends them with as few
+ *  transactions as possible: writes to consecutive registers are merged
+ *  into one write multiple registers (0x10) request. If the same register
+ *  is written more than once the last value is sent.
+ *
+ *  A batch on a ModbusMaster with slave address 0 is broadcast to all
+ *  slaves (group commands). Broadcasts are not answered so a successful
+ *  status only means that the request was sent.
+ */
+
+#ifndef MODBUSWRITEBATCH_H_
+#define MODBUSWRITEBATCH_H_
+
+#include "ModbusMaster.h"
+
+class ModbusWriteBatch {
+public:
+	static const int MaxWrites = 32;
+	static const int MaxRun = 64; /* transmit buffer size of ModbusMaster */
+	/* called from flush() with the ModbusMaster status of the write */
+	typedef void (*Callback)(void *arg, uint16_t address, uint8_t status);
+
+	ModbusWriteBatch(ModbusMaster *master);
+	ModbusWriteBatch(const ModbusWriteBatch &) = delete;
+	virtual ~ModbusWriteBatch();
+	/* queue a write. Returns a handle for status() or -1 if the batch is full */
+	int add(uint16_t address, uint16_t value, Callback cb = nullptr, void *arg = nullptr);
+	int flush(); /* send the queued writes. Returns the number of writes that failed */
+	uint8_t status(int handle) const; /* status of a write, ku8MBTransactionPending until sent */
+	int pending() const; /* number of writes waiting for flush() */
+	void clear();
+private:
+	struct Write {
+		uint16_t address;
+		uint16_t value;
+		uint8_t status;
+		Callback cb;
+		void *arg;
+	};
+	ModbusMaster *m;
+	Write writes[MaxWrites];
+	int count;
+	int sent; /* writes before this index have been flushed */
+};
+
+#endif /* MODBUSWRITEBATCH_H_ */
@@ -8,22 +8,48 @@
 
 
 
-SerialPort::SerialPort() {
-	if(!u) {
-		LpcPinMap none = {-1, -1}; // unused pin has negative values in it
-		LpcPinMap txpin = { 0, 28 }; // transmit pin that goes to rs485 driver chip
-		LpcPinMap rxpin = { 0, 24 }; // receive pin that goes to rs485 driver chip
-		LpcPinMap rtspin = { 1, 0 }; // handshake pin that is used to set tranmitter direction
-		LpcUartConfig cfg = { LPC_USART1, 9600, UART_CFG_DATALEN_8 | UART_CFG_PARITY_NONE | UART_CFG_STOPLEN_2, true, txpin, rxpin, rtspin, none };
-		u = new LpcUart(cfg);
+SerialPort *SerialPort::port1 = nullptr;
+/* Responses on the default bus go to the receive hook so only the transmit side needs room for a full ADU */
+static uint8_t port1_rx[64];
+static uint8_t port1_tx[256];
+
+SerialPort::SerialPort(const LpcUartConfig &uart, const SerialPortConfig &line, bool gapTimer)
+	: cfg(line), timer(nullptr) {
+	LpcUartConfig ucfg = uart;
+	ucfg.speed = cfg.speed;
+	ucfg.data = cfg.data;
+	ucfg.dma_rx = false; // Modbus receive needs per character timing
+	u = new LpcUart(ucfg);
+	u->rs485(cfg.turnaround, cfg.oeActiveHigh);
+
+	// only one bus can have the RIT, the others delimit frames by their length
+	if(gapTimer && !ModbusGapTimer::inUse()) {
+		timer = new ModbusGapTimer;
+		timer->setBaudRate(cfg.speed, bitsPerChar(), cfg.frameGapUs);
 	}
 }
 
-LpcUart *SerialPort::u = nullptr;
-
 SerialPort::~SerialPort() {
 	/* DeInitialize UART peripheral */
+	delete timer;
 	delete u;
+	if(port1 == this) port1 = nullptr;
+}
+
+SerialPort *SerialPort::defaultPort() {
+	if(!port1) {
+		LpcPinMap none = {-1, -1}; // unused pin has negative values in it
+		LpcPinMap txpin = { 0, 28 }; // transmit pin that goes to rs485 driver chip
+		LpcPinMap rxpin = { 0, 24 }; // receive pin that goes to rs485 driver chip
+		LpcPinMap rtspin = { 1, 0 }; // handshake pin that is used to set tranmitter direction
+		LpcUartConfig ucfg = { LPC_USART1, 9600, 0, true, txpin, rxpin, rtspin, none,
+				true, false, // DMA transmit only: Modbus receive needs per character timing
+				port1_rx, sizeof(port1_rx), port1_tx, sizeof(port1_tx) };
+		// Modbus RTU default: 9600 8N2, no turnaround delay, active high driver enable
+		SerialPortConfig line = { 9600, UART_CFG_DATALEN_8 | UART_CFG_PARITY_NONE | UART_CFG_STOPLEN_2, false, true, 0 };
+		port1 = new SerialPort(ucfg, line, true);
+	}
+	return port1;
 }
 
 int SerialPort::available() {
@@ -31,8 +57,34 @@ int SerialPort::available() {
 }
 
 void SerialPort::begin(int speed) {
-	u->speed(speed);
+	SerialPortConfig c = cfg;
+	c.speed = speed;
+	configure(c);
+}
 
+void SerialPort::configure(const SerialPortConfig &config) {
+	if(config.speed != cfg.speed) u->speed(config.speed);
+	if(config.data != cfg.data) u->format(config.data);
+	if(config.turnaround != cfg.turnaround || config.oeActiveHigh != cfg.oeActiveHigh) {
+		u->rs485(config.turnaround, config.oeActiveHigh);
+	}
+	cfg = config;
+	if(timer) timer->setBaudRate(cfg.speed, bitsPerChar(), cfg.frameGapUs);
+}
+
+ModbusGapTimer *SerialPort::gapTimer() {
+	return timer;
+}
+
+const SerialPortConfig &SerialPort::config() const {
+	return cfg;
+}
+
+int SerialPort::bitsPerChar() const {
+	int bits = 1 + 7 + ((cfg.data >> 2) & 0x3); // start and data bits
+	if(cfg.data & (0x2 << 4)) ++bits; // parity
+	bits += (cfg.data & UART_CFG_STOPLEN_2) ? 2 : 1;
+	return bits;
 }
 
 int SerialPort::read() {
@@ -40,6 +92,18 @@ int SerialPort::read() {
 	if(u->read(&byte, 1, 1)> 0) return (byte);
 	return -1;
 }
+
+int SerialPort::readFrame(uint8_t *buf, int max, TickType_t deadline, TickType_t interByteTimeout) {
+	return u->read_frame((char *) buf, max, deadline, interByteTimeout);
+}
+
+TickType_t SerialPort::frameGapTicks() const {
+	uint32_t us = cfg.frameGapUs;
+	if(us == 0) us = (7 * bitsPerChar() * 1000000U / 2 + cfg.speed - 1) / cfg.speed; // t3.5
+	// one extra tick because the tick that is running when the wait starts is only partially left
+	return (us * configTICK_RATE_HZ + 999999U) / 1000000U + 1;
+}
+
 int SerialPort::write(const char* buf, int len) {
 	return u->write(buf, len);
 }
@@ -54,3 +118,15 @@ int SerialPort::print(int val, int format) {
 void SerialPort::flush() {
 	while(!u->txempty()) __WFI();
 }
+
+bool SerialPort::setRxHook(void (*hook)(void *arg, uint8_t c, portBASE_TYPE *hpw), void *arg) {
+	return u->set_rx_hook(hook, arg);
+}
+
+void SerialPort::setErrorHook(void (*hook)(void *arg, uint32_t errors, portBASE_TYPE *hpw), void *arg) {
+	u->set_error_callback(hook, arg);
+}
+
+LpcUartStats SerialPort::stats() const {
+	return u->stats();
+}
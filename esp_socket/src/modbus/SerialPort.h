@@ -10,22 +10,51 @@
 #define SERIALPORT_H_
 
 #include "LpcUart.h"
+#include "ModbusGapTimer.h"
 
 #define millis() xTaskGetTickCount()
 
+/* line settings of an RS-485 bus */
+struct SerialPortConfig {
+	uint32_t speed;
+	uint32_t data;       /* data length, parity and stop bits (UART_CFG_xxx) */
+	bool turnaround;     /* keep the driver enabled for one character time after the last stop bit */
+	bool oeActiveHigh;   /* driver enable polarity */
+	uint32_t frameGapUs; /* silence that ends a frame in microseconds, 0 = t3.5 of the speed */
+};
 
+/* One RS-485 bus. Each bus has its own UART, line settings and, if available,
+ * the gap timer for t1.5/t3.5 timing (there is only one RIT on the chip). */
 class SerialPort {
 public:
-	SerialPort();
+	SerialPort(const LpcUartConfig &uart, const SerialPortConfig &line, bool gapTimer = false);
+	SerialPort(const SerialPort &) = delete;
 	virtual ~SerialPort();
+	static SerialPort *defaultPort(); /* USART1 bus of the board, created on first use */
 	int available();
-	void begin(int speed = 9600);
+	void begin(int speed = 9600); /* change speed, keep the other settings */
+	void configure(const SerialPortConfig &config);
+	const SerialPortConfig &config() const;
+	int bitsPerChar() const; /* start, data, parity and stop bits */
+	ModbusGapTimer *gapTimer(); /* nullptr if the bus has no gap timer */
 	int read();
+	/* Read a whole frame in one call. Waits for the first character until the deadline (tick count)
+	 * and returns after interByteTimeout ticks of silence, when max bytes have been read or when the
+	 * deadline passes. The calling task sleeps while waiting. Returns the number of bytes read */
+	int readFrame(uint8_t *buf, int max, TickType_t deadline, TickType_t interByteTimeout);
+	TickType_t frameGapTicks() const; /* silence that ends a frame rounded up to whole ticks */
 	int write(const char* buf, int len);
 	int print(int val, int format);
 	void flush();
+	bool setRxHook(void (*hook)(void *arg, uint8_t c, portBASE_TYPE *hpw), void *arg);
+	/* hook is called in ISR context on framing, parity, noise and overrun errors and on break */
+	void setErrorHook(void (*hook)(void *arg, uint32_t errors, portBASE_TYPE *hpw), void *arg);
+	LpcUartStats stats() const; /* line error counters and buffer usage of the bus */
 private:
-	static LpcUart *u;
+	LpcUart *u;
+	SerialPortConfig cfg;
+	ModbusGapTimer *timer;
+	static SerialPort *port1;
 };
 
 #endif /* SERIALPORT_H_ */
@@ -0,0 +1,207 @@
+/*
+ * ModbusStatsPublisher.c
+ *
+ *  Created on: 18.10.2026
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Broker and client configuration. */
+#include "demo_config.h"
+
+/* MQTT library includes. */
+#include "core_mqtt.h"
+
+/* Exponential backoff retry include. */
+#include "backoff_algorithm.h"
+
+/* Transport interface include. */
+#include "using_plaintext.h"
+
+#include "ModbusStats.h"
+#include "ModbusStatsPublisher.h"
+
+/**
+ * @brief Topic of the statistics.
+ */
+#define statsTOPIC                          democonfigCLIENT_IDENTIFIER "modbus/stats"
+
+/**
+ * @brief Size of the statistics message. Slaves that don't fit are left out.
+ */
+#define statsMESSAGE_BUFFER_SIZE            ( 1024U )
+
+/**
+ * @brief Size of the MQTT packet buffer. Must hold the PUBLISH packet of a whole message.
+ */
+#define statsNETWORK_BUFFER_SIZE            ( statsMESSAGE_BUFFER_SIZE + 64U )
+
+/**
+ * @brief Reconnect backoff of the connection to the broker.
+ */
+#define statsRETRY_BACKOFF_BASE_MS          ( 1000U )
+#define statsRETRY_MAX_BACKOFF_DELAY_MS     ( 60000U )
+
+#define statsCONNACK_RECV_TIMEOUT_MS        ( 1000U )
+#define statsTRANSPORT_SEND_RECV_TIMEOUT_MS ( 200U )
+#define statsSTACKSIZE                      ( configMINIMAL_STACK_SIZE + 256 )
+
+/*-----------------------------------------------------------*/
+
+struct NetworkContext
+{
+    PlaintextTransportParams_t * pParams;
+};
+
+static void prvStatsPublisherTask( void * pvParameters );
+static bool prvConnect( MQTTContext_t * pxMQTTContext,
+                        NetworkContext_t * pxNetworkContext,
+                        uint16_t usKeepAliveSeconds );
+static bool prvPublish( MQTTContext_t * pxMQTTContext );
+static uint32_t prvGetTimeMs( void );
+static void prvEventCallback( MQTTContext_t * pxMQTTContext,
+                              MQTTPacketInfo_t * pxPacketInfo,
+                              MQTTDeserializedInfo_t * pxDeserializedInfo );
+
+/* Static: statistics of several slaves don't fit on the task stack. */
+static char cMessage[ statsMESSAGE_BUFFER_SIZE ];
+static uint8_t ucNetworkBuffer[ statsNETWORK_BUFFER_SIZE ];
+static MQTTFixedBuffer_t xBuffer =
+{
+    .pBuffer = ucNetworkBuffer,
+    .size    = statsNETWORK_BUFFER_SIZE
+};
+
+/*-----------------------------------------------------------*/
+
+void vStartModbusStatsPublisher( uint32_t ulPeriodMs )
+{
+    xTaskCreate( prvStatsPublisherTask,
+                 "mbstats",
+                 statsSTACKSIZE,
+                 ( void * ) ( uintptr_t ) ulPeriodMs,
+                 tskIDLE_PRIORITY,
+                 NULL );
+}
+/*-----------------------------------------------------------*/
+
+static void prvStatsPublisherTask( void * pvParameters )
+{
+    const uint32_t ulPeriodMs = ( uint32_t ) ( uintptr_t ) pvParameters;
+    /* broker drops us if nothing is heard from us for 1.5 keep-alive periods */
+    const uint16_t usKeepAliveSeconds = ( uint16_t ) ( ulPeriodMs / 1000U + 10U );
+    NetworkContext_t xNetworkContext = { 0 };
+    PlaintextTransportParams_t xPlaintextTransportParams = { 0 };
+    MQTTContext_t xMQTTContext;
+    BackoffAlgorithmContext_t xReconnectParams;
+    uint16_t usNextRetryBackOff = 0U;
+
+    xNetworkContext.pParams = &xPlaintextTransportParams;
+    BackoffAlgorithm_InitializeParams( &xReconnectParams,
+                                       statsRETRY_BACKOFF_BASE_MS,
+                                       statsRETRY_MAX_BACKOFF_DELAY_MS,
+                                       BACKOFF_ALGORITHM_RETRY_FOREVER );
+
+    for( ; ; )
+    {
+        if( prvConnect( &xMQTTContext, &xNetworkContext, usKeepAliveSeconds ) )
+        {
+            BackoffAlgorithm_InitializeParams( &xReconnectParams,
+                                               statsRETRY_BACKOFF_BASE_MS,
+                                               statsRETRY_MAX_BACKOFF_DELAY_MS,
+                                               BACKOFF_ALGORITHM_RETRY_FOREVER );
+
+            /* The process loop waits out the period and keeps the connection alive. */
+            while( prvPublish( &xMQTTContext ) &&
+                   ( MQTT_ProcessLoop( &xMQTTContext, ulPeriodMs ) == MQTTSuccess ) )
+            {
+            }
+
+            LogWarn( ( "Modbus statistics: connection to the broker lost." ) );
+            ( void ) MQTT_Disconnect( &xMQTTContext );
+            ( void ) Plaintext_FreeRTOS_Disconnect( &xNetworkContext );
+        }
+
+        ( void ) BackoffAlgorithm_GetNextBackoff( &xReconnectParams, uxRand(), &usNextRetryBackOff );
+        vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static bool prvConnect( MQTTContext_t * pxMQTTContext,
+                        NetworkContext_t * pxNetworkContext,
+                        uint16_t usKeepAliveSeconds )
+{
+    MQTTConnectInfo_t xConnectInfo;
+    TransportInterface_t xTransport;
+    bool xSessionPresent;
+
+    if( Plaintext_FreeRTOS_Connect( pxNetworkContext,
+                                    democonfigMQTT_BROKER_ENDPOINT,
+                                    democonfigMQTT_BROKER_PORT,
+                                    statsTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                    statsTRANSPORT_SEND_RECV_TIMEOUT_MS ) != PLAINTEXT_TRANSPORT_SUCCESS )
+    {
+        LogWarn( ( "Modbus statistics: connection to %s failed.", democonfigMQTT_BROKER_ENDPOINT ) );
+        return false;
+    }
+
+    ( void ) memset( ( void * ) &xTransport, 0x00, sizeof( xTransport ) );
+    xTransport.pNetworkContext = pxNetworkContext;
+    xTransport.send = Plaintext_FreeRTOS_send;
+    xTransport.recv = Plaintext_FreeRTOS_recv;
+
+    ( void ) memset( ( void * ) &xConnectInfo, 0x00, sizeof( xConnectInfo ) );
+    xConnectInfo.cleanSession = true;
+    xConnectInfo.pClientIdentifier = democonfigCLIENT_IDENTIFIER "-stats";
+    xConnectInfo.clientIdentifierLength = ( uint16_t ) strlen( democonfigCLIENT_IDENTIFIER "-stats" );
+    xConnectInfo.keepAliveSeconds = usKeepAliveSeconds;
+
+    if( ( MQTT_Init( pxMQTTContext, &xTransport, prvGetTimeMs, prvEventCallback, &xBuffer ) != MQTTSuccess ) ||
+        ( MQTT_Connect( pxMQTTContext, &xConnectInfo, NULL, statsCONNACK_RECV_TIMEOUT_MS, &xSessionPresent ) != MQTTSuccess ) )
+    {
+        LogWarn( ( "Modbus statistics: MQTT connection to %s failed.", democonfigMQTT_BROKER_ENDPOINT ) );
+        ( void ) Plaintext_FreeRTOS_Disconnect( pxNetworkContext );
+        return false;
+    }
+
+    return true;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvPublish( MQTTContext_t * pxMQTTContext )
+{
+    MQTTPublishInfo_t xMQTTPublishInfo;
+
+    ( void ) memset( ( void * ) &xMQTTPublishInfo, 0x00, sizeof( xMQTTPublishInfo ) );
+    xMQTTPublishInfo.qos = MQTTQoS0;
+    xMQTTPublishInfo.pTopicName = statsTOPIC;
+    xMQTTPublishInfo.topicNameLength = ( uint16_t ) strlen( statsTOPIC );
+    xMQTTPublishInfo.pPayload = cMessage;
+    xMQTTPublishInfo.payloadLength = modbus_stats_json( cMessage, sizeof( cMessage ) );
+
+    /* Packet ID is not used for a QoS0 publish. */
+    return MQTT_Publish( pxMQTTContext, &xMQTTPublishInfo, 0U ) == MQTTSuccess;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvGetTimeMs( void )
+{
+    return ( uint32_t ) xTaskGetTickCount() * ( 1000U / configTICK_RATE_HZ );
+}
+/*-----------------------------------------------------------*/
+
+static void prvEventCallback( MQTTContext_t * pxMQTTContext,
+                              MQTTPacketInfo_t * pxPacketInfo,
+                              MQTTDeserializedInfo_t * pxDeserializedInfo )
+{
+    /* Nothing is subscribed: only PINGRESP arrives and the library handles it. */
+    ( void ) pxMQTTContext;
+    ( void ) pxPacketInfo;
+    ( void ) pxDeserializedInfo;
+}
@@ -0,0 +1,27 @@
+/*
+ * ModbusStatsPublisher.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Task that publishes the Modbus transaction statistics as JSON on
+ *  <client id>modbus/stats. Uses a connection of its own to the broker of
+ *  demo_config.h and reconnects with backoff when the connection is lost.
+ */
+
+#ifndef MODBUSSTATSPUBLISHER_H_
+#define MODBUSSTATSPUBLISHER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Create the publisher task. Statistics are published every ulPeriodMs milliseconds */
+void vStartModbusStatsPublisher( uint32_t ulPeriodMs );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODBUSSTATSPUBLISHER_H_ */
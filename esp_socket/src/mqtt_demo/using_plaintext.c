@@ -114,6 +114,12 @@ PlaintextTransportStatus_t Plaintext_FreeRTOS_Connect( NetworkContext_t * pNetwo
                         pHostName,
                         (int)socketStatus ) );
             plaintextStatus = PLAINTEXT_TRANSPORT_CONNECT_FAILURE;
+            /* Don't keep the link of a failed attempt: the caller retries with a new one. */
+            if( pPlaintextTransportParams->tcpSocket != FREERTOS_INVALID_SOCKET )
+            {
+                esp_close( pPlaintextTransportParams->tcpSocket );
+            }
+            pPlaintextTransportParams->tcpSocket = FREERTOS_INVALID_SOCKET;
         }
     }
 
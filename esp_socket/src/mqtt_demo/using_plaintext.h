@@ -152,4 +152,7 @@ int32_t Plaintext_FreeRTOS_send( NetworkContext_t * pNetworkContext,
                                  const void * pBuffer,
                                  size_t bytesToSend );
 
+/* Random number for the jitter of reconnect backoff */
+uint32_t uxRand( void );
+
 #endif /* ifndef USING_PLAINTEXT_H */
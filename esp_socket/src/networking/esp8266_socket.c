@@ -15,7 +15,12 @@
 #include <ctype.h>
 #include <string.h>
 
-#include "ring_buffer.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "event_groups.h"
+#include "semphr.h"
+#include "stream_buffer.h"
 
 #include "esp8266_socket.h"
 
@@ -48,20 +53,77 @@ typedef struct smi_ smi;
 typedef void (*smf)(smi *, const event *);  // prototype of state handler function pointer
 
 #define EVQ_SIZE 32
+#define ESP_TICK_MS 100 // period of eTick
+
+// event group bits for the waiting callers
+#define ESP_READY_BIT     (1 << 0) // in stReady: the module takes requests
+#define ESP_DONE_BIT      (1 << 1) // request has been completed
+
+// multiple connection mode (AT+CIPMUX=1) supports five links
+#define ESP_MAX_LINKS     5
+#define ESP_LINK_RXSIZE   512  // received data of a link that the application has not read yet
+#define ESP_MAX_SEND      2048 // AT+CIPSEND limit
 
 #define SMI_BUFSIZE 80
 #define RC_NOT_AVAILABLE  -1
 #define RC_OK     0
 #define RC_ERROR  1
 
+/* Streaming matcher of response strings. The KMP failure tables of the strings are
+ * built when a state starts waiting for them; after that each received character is
+ * handled without rescanning the response, so responses may be longer than the buffer.
+ * A string that ends with ':' is a field: the number after its first occurrence is stored in value */
+#define SM_MAX_PATTERNS 4
+#define SM_MAX_PATLEN   20
+
+typedef struct {
+	int count; // number of strings, zero when not started
+	const char *pat[SM_MAX_PATTERNS];
+	uint8_t len[SM_MAX_PATTERNS];
+	uint8_t matched[SM_MAX_PATTERNS]; // length of the matched prefix
+	uint8_t fail[SM_MAX_PATTERNS][SM_MAX_PATLEN];
+	bool in_field;  // reading the number of a field
+	bool has_value; // a field has been read
+	int value;      // number of the field
+} matcher;
+
 struct smi_ {
 	smf state;  // current state (function pointer)
 	smf next_state; // next state (function pointer)
-	RINGBUFF_T EspEventQ;
-	event evq_buf[EVQ_SIZE];
+	QueueHandle_t EspEventQ;
+	TaskHandle_t task; // task that runs the state machine
+	EventGroupHandle_t events; // ESP_xxx_BIT of the current state
+	int unread; // characters the current state left in the receive buffer
+	SemaphoreHandle_t api; // one request at a time
+	// request to the state machine task
+	int req_link;
+	const char *req_data;
+	int req_len;
+	int req_result;
+	// links (sockets)
+	struct {
+		bool used;      // allocated by esp_socket()
+		bool connected; // TCP connection is open
+		StreamBufferHandle_t rx;
+		uint32_t dropped; // received characters that did not fit in the buffer
+	} links[ESP_MAX_LINKS];
+	// demultiplexer of unsolicited messages
+	int dm;          // DemuxState
+	bool line_start; // next character starts a line
+	char held[12];   // possible start of a message
+	int held_len;
+	int held_pos;    // next held character to give to the states
+	int ipd_link;
+	int ipd_len;
+	// cached module state for the short path after a failure
+	bool configured;       // station mode has been set and multiple connections enabled
+	TickType_t lost_tick;  // a connection was lost at this time, zero if none is pending
+	uint32_t reconnect_ms; // time from the loss of a connection to the next successful connect
+	uint32_t reconnect_max;
     int timer;
     int count;
     int pos;
+    matcher match;
     char buffer[SMI_BUFSIZE];
     char ssid[32]; // SSID
     char pwd[32]; // password
@@ -75,15 +137,18 @@ static void stStationModeCheck(smi *ctx, const event *e);
 static void stStationModeSet(smi *ctx, const event *e);
 static void stConnectAP(smi *ctx, const event *e);
 static void stReady(smi *ctx, const event *e);
+static void stStatus(smi *ctx, const event *e);
+static void stMux(smi *ctx, const event *e);
 static void stConnectTCP(smi *ctx, const event *e);
-static void stConnected(smi *ctx, const event *e);
+static void stSend(smi *ctx, const event *e);
+static void stSendData(smi *ctx, const event *e);
 static void stCloseTCP(smi *ctx, const event *e);
-static void stPassthrough(smi *ctx, const event *e);
-static void stPassthroughOK(smi *ctx, const event *e);
+static void stResync(smi *ctx, const event *e);
+static void stResyncClose(smi *ctx, const event *e);
 static void stAT(smi *ctx, const event *e);
-static void stCommandMode(smi *ctx, const event *e);
 
 static void EspSocketRun(smi *ctx);
+static void EspSocketTask(void *pvParameters);
 
 
 
@@ -108,115 +173,156 @@ void smi_init(smi *ctx)
     memset(ctx, 0, sizeof(smi));
     ctx->state = stInit;
     ctx->next_state = stInit;
-    RingBuffer_Init(&ctx->EspEventQ, ctx->evq_buf, sizeof(event), EVQ_SIZE);
+    ctx->EspEventQ = xQueueCreate(EVQ_SIZE, sizeof(event));
+    ctx->events = xEventGroupCreate();
+    ctx->api = xSemaphoreCreateMutex();
+    ctx->line_start = true;
+}
 
-    ctx->state(ctx, &evEnter); // enter initial state
+/* Pass an event from another task to the state machine task */
+static void post_event(smi *ctx, EventType ev)
+{
+    const event e = { ev };
+    xQueueSend(ctx->EspEventQ, &e, portMAX_DELAY);
+    xTaskNotifyGive(ctx->task);
 }
 
-    
-int esp_socket(const char *ssid, const char *password)
+/* Sleep until the state machine is in one of the states */
+static void wait_state(smi *ctx, EventBits_t bits)
 {
-    smi_init(&EspSocketInstance);
-    
-    
-    strncpy(EspSocketInstance.ssid, ssid, 32);
-    strncpy(EspSocketInstance.pwd, password, 32);
-    
-    
-    while(EspSocketInstance.state != stReady) {
-    	// run esp task and run ticks
-    	EspSocketRun(&EspSocketInstance);
-    }
-   
-    return 0;    
+    xEventGroupWaitBits(ctx->events, bits, pdFALSE, pdFALSE, portMAX_DELAY);
 }
 
+/* Pass a request to the state machine task and wait until it has been completed.
+ * Requests are accepted in stReady */
+static int request(smi *ctx, EventType ev, int link, const char *data, int len)
+{
+    xSemaphoreTake(ctx->api, portMAX_DELAY);
+    wait_state(ctx, ESP_READY_BIT);
+    ctx->req_link = link;
+    ctx->req_data = data;
+    ctx->req_len = len;
+    ctx->req_result = -1;
+    xEventGroupClearBits(ctx->events, ESP_DONE_BIT);
+    post_event(ctx, ev);
+    xEventGroupWaitBits(ctx->events, ESP_DONE_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+    int rc = ctx->req_result;
+    xSemaphoreGive(ctx->api);
 
+    return rc;
+}
 
-int esp_connect(int sockfd, const char *addr, int port)
+/* Called by the state machine when the request is done */
+static void complete(smi *ctx, int result)
 {
-    I_DONT_USE(sockfd);
+    ctx->req_result = result;
+    xEventGroupSetBits(ctx->events, ESP_DONE_BIT);
+    TRAN(stReady);
+}
 
-    strncpy(EspSocketInstance.sa_data,addr,sizeof(EspSocketInstance.sa_data)-1);
-    EspSocketInstance.sa_data[sizeof(EspSocketInstance.sa_data)-1] = '\0';
-    port2str(port, EspSocketInstance.sa_port);
+static bool valid_link(int sockfd)
+{
+    return sockfd >= 0 && sockfd < ESP_MAX_LINKS && EspSocketInstance.links[sockfd].used;
+}
 
-    const event e = { eConnect };
+    
+/* Allocate a socket (link). The first call starts the module and joins the access point */
+int esp_socket(const char *ssid, const char *password)
+{
+    smi *ctx = &EspSocketInstance;
 
-    RingBuffer_Insert(&EspSocketInstance.EspEventQ,&e);
+    if(ctx->task == NULL) {
+        smi_init(ctx);
 
-    int rc = 0;
+        strncpy(ctx->ssid, ssid, 32);
+        strncpy(ctx->pwd, password, 32);
 
-    while(EspSocketInstance.state != stConnected) {
-    	// run esp task and run ticks
-    	EspSocketRun(&EspSocketInstance);
+        // state machine is entered in the task so that all state handlers run in the same task
+        xTaskCreate(EspSocketTask, "esp", configMINIMAL_STACK_SIZE * 5, ctx,
+                tskIDLE_PRIORITY + 2, &ctx->task);
     }
 
-    return rc;
+    wait_state(ctx, ESP_READY_BIT);
+
+    int sockfd = -1;
+    xSemaphoreTake(ctx->api, portMAX_DELAY);
+    for(int i = 0; i < ESP_MAX_LINKS; ++i) {
+        if(!ctx->links[i].used) {
+            // receive buffer is kept for the next user of the link
+            if(ctx->links[i].rx == NULL) ctx->links[i].rx = xStreamBufferCreate(ESP_LINK_RXSIZE, 1);
+            if(ctx->links[i].rx == NULL) break;
+            xStreamBufferReset(ctx->links[i].rx);
+            ctx->links[i].connected = false;
+            ctx->links[i].dropped = 0;
+            ctx->links[i].used = true;
+            sockfd = i;
+            break;
+        }
+    }
+    xSemaphoreGive(ctx->api);
+   
+    return sockfd;    
+}
+
+
+
+int esp_connect(int sockfd, const char *addr, int port)
+{
+    if(!valid_link(sockfd)) return -1;
+
+    // port is passed in place of the length.
+    // The link stays allocated after a failure: the caller releases it with esp_close()
+    return request(&EspSocketInstance, eConnect, sockfd, addr, port);
 }
 
 int esp_read(int sockfd, void *data, int length) 
 {
-    I_DONT_USE(sockfd);
-    int count = 0;
-    
-    if(EspSocketInstance.state == stConnected) {
-#if 0
-    	DEBUGP("[rd=%d]\r\n", length);
-    	// read data
-        while(count < length && serial_get_char(&EspSocketInstance, data)) {
-        	//char c = *((unsigned char *)data);
-        	//DEBUGP("[%02X %c]\r\n", c , isprint(c) ? c : '.');
-            ++count;
-            ++data;
-        }
-#else
-        count = serial_read_buf(&EspSocketInstance, data, length);
-#endif
-    }
-    
-    return count;
+    if(!valid_link(sockfd)) return -1;
+    StreamBufferHandle_t rx = EspSocketInstance.links[sockfd].rx;
+
+    // data that arrived before the connection was closed can still be read
+    if(!EspSocketInstance.links[sockfd].connected && xStreamBufferIsEmpty(rx)) return 0;
+
+    return xStreamBufferReceive(rx, data, length, 20 * length);
 }
 
 int esp_write(int sockfd, const void *data, int length)
 {
-    I_DONT_USE(sockfd);
+    if(!valid_link(sockfd) || !EspSocketInstance.links[sockfd].connected) return -1;
 
-    if(EspSocketInstance.state == stConnected) {
-        // write data
-        serial_write_buf(&EspSocketInstance, data, length);
-    }
-    
-    return length;
+    return request(&EspSocketInstance, eSend, sockfd, data, length);
 }
 
 int esp_close(int sockfd)
 {
-    return esp_shutdown(sockfd, -1);
+    if(!valid_link(sockfd)) return -1;
+
+    int rc = esp_shutdown(sockfd, -1);
+    EspSocketInstance.links[sockfd].used = false;
+
+    return rc;
 }
 
 int esp_shutdown(int sockfd, int how)
 {
-    I_DONT_USE(sockfd);
     I_DONT_USE(how);
-    const event e = { eDisconnect };
-    
-    RingBuffer_Insert(&EspSocketInstance.EspEventQ,&e);
-    while(EspSocketInstance.state != stReady) {
-    	// run esp task and run ticks
-    	EspSocketRun(&EspSocketInstance);
-    }
+    if(!valid_link(sockfd)) return -1;
+    if(!EspSocketInstance.links[sockfd].connected) return 0;
+
+    return request(&EspSocketInstance, eDisconnect, sockfd, NULL, 0);
+}
 
-    return 0;
+uint32_t esp_reconnect_ms(uint32_t *max_ms)
+{
+    if(max_ms) *max_ms = EspSocketInstance.reconnect_max;
+    return EspSocketInstance.reconnect_ms;
 }
 
 int esp_peek(int sockfd)
 {
-	int cnt = 0;
-    if(EspSocketInstance.state == stConnected) {
-    	cnt = serial_peek(&EspSocketInstance);
-    }
-    return cnt;
+    if(!valid_link(sockfd)) return 0;
+
+    return xStreamBufferBytesAvailable(EspSocketInstance.links[sockfd].rx);
 }
 
 
@@ -239,10 +345,197 @@ void stStateTemplate(smi *ctx, const event *e)
 }
 #endif
 
+/* Unsolicited messages are removed from the received data before the states see it:
+ *   +IPD,<link>,<length>:<data>   data received on a link
+ *   <link>,CLOSED\r\n             link was closed
+ * Both start at the beginning of a line. */
+typedef enum { dmLine, dmMatch, dmLink, dmLength } DemuxState;
+typedef enum { msgNone, msgPartial, msgIpd, msgClosed } MessageMatch;
+
+static MessageMatch match_message(const char *s, int len)
+{
+    static const char ipd[] = "+IPD,";
+    static const char closed[] = ",CLOSED\r\n";
+
+    if(s[0] == '+') {
+        if(strncmp(s, ipd, len) != 0) return msgNone;
+        return len == sizeof(ipd) - 1 ? msgIpd : msgPartial;
+    }
+    if(len == 1) return msgPartial; // link number
+    if(strncmp(s + 1, closed, len - 1) != 0) return msgNone;
+    return len - 1 == sizeof(closed) - 1 ? msgClosed : msgPartial;
+}
+
+/* Connection of a link was closed by the remote end or by a request */
+static void link_lost(smi *ctx, int link)
+{
+    if(ctx->links[link].connected && ctx->lost_tick == 0) ctx->lost_tick = get_ticks() | 1; // zero means none
+    ctx->links[link].connected = false;
+}
+
+/* Move the data of +IPD to the receive buffer of the link */
+static void receive_ipd(smi *ctx)
+{
+    char tmp[64];
+    StreamBufferHandle_t rx = NULL;
+    if(ctx->ipd_link >= 0 && ctx->ipd_link < ESP_MAX_LINKS) rx = ctx->links[ctx->ipd_link].rx;
+
+    while(ctx->ipd_len > 0) {
+        int n = serial_read_buf(ctx, tmp, ctx->ipd_len < (int) sizeof(tmp) ? ctx->ipd_len : (int) sizeof(tmp));
+        if(n <= 0) break; // module stopped sending: the rest is lost
+        ctx->ipd_len -= n;
+        // don't wait long for the application: the other links and requests are blocked meanwhile
+        int sent = rx ? xStreamBufferSend(rx, tmp, n, pdMS_TO_TICKS(100)) : 0;
+        if(rx && sent < n) ctx->links[ctx->ipd_link].dropped += n - sent;
+    }
+}
+
+/* Read a character for the states. Works like serial_get_char() but
+ * leaves the unsolicited messages out and handles them */
+static int sm_get_char(smi *ctx, char *p)
+{
+    char c;
+
+    for(;;) {
+        if(ctx->held_pos < ctx->held_len) {
+            // characters that turned out not to be a message
+            c = ctx->held[ctx->held_pos++];
+            if(ctx->held_pos == ctx->held_len) ctx->held_len = ctx->held_pos = 0;
+            break;
+        }
+        if(!serial_get_char(ctx, &c)) return 0;
+
+        if(ctx->dm == dmLine) {
+            if(ctx->line_start && (c == '+' || isdigit((int) c))) {
+                ctx->held[0] = c;
+                ctx->held_len = 1;
+                ctx->held_pos = 1;
+                ctx->dm = dmMatch;
+                continue;
+            }
+            break;
+        }
+        else if(ctx->dm == dmMatch) {
+            ctx->held[ctx->held_len++] = c;
+            ctx->held_pos = ctx->held_len;
+            MessageMatch m = match_message(ctx->held, ctx->held_len);
+            if(m == msgPartial) continue;
+            ctx->dm = dmLine;
+            if(m == msgNone) {
+                ctx->held_pos = 0; // give the characters to the states
+                ctx->line_start = false;
+                continue;
+            }
+            if(m == msgIpd) {
+                ctx->dm = dmLink;
+                ctx->ipd_link = 0;
+            }
+            else {
+                int link = ctx->held[0] - '0';
+                if(link < ESP_MAX_LINKS) link_lost(ctx, link);
+                DEBUGP("link %d closed\r\n", link);
+                ctx->line_start = true;
+            }
+            ctx->held_len = 0;
+            ctx->held_pos = 0;
+        }
+        else if(ctx->dm == dmLink) {
+            if(isdigit((int) c)) ctx->ipd_link = ctx->ipd_link * 10 + c - '0';
+            else if(c == ',') {
+                ctx->dm = dmLength;
+                ctx->ipd_len = 0;
+            }
+            else ctx->dm = dmLine;
+        }
+        else if(ctx->dm == dmLength) {
+            if(isdigit((int) c)) ctx->ipd_len = ctx->ipd_len * 10 + c - '0';
+            else {
+                if(c == ':') receive_ipd(ctx);
+                ctx->dm = dmLine;
+                ctx->line_start = true;
+            }
+        }
+    }
+
+    ctx->line_start = (c == '\n');
+    *p = c;
+    return 1;
+}
+
 void init_counters(smi *ctx) {
     ctx->count = 0;
     ctx->pos = 0;
     ctx->timer = 0;
+    ctx->match.count = 0;
+}
+
+static void matcher_start(matcher *m, const char *const *p, int count)
+{
+    configASSERT(count <= SM_MAX_PATTERNS);
+    m->count = count;
+    m->in_field = false;
+    m->has_value = false;
+    m->value = 0;
+    for(int i = 0; i < count; ++i) {
+        const char *pat = p[i];
+        int len = strlen(pat);
+        configASSERT(len > 0 && len <= SM_MAX_PATLEN);
+        m->pat[i] = pat;
+        m->len[i] = len;
+        m->matched[i] = 0;
+        // fail[j] is the length of the longest proper prefix of pat[0..j] that is also its suffix
+        int k = 0;
+        m->fail[i][0] = 0;
+        for(int j = 1; j < len; ++j) {
+            while(k > 0 && pat[j] != pat[k]) k = m->fail[i][k - 1];
+            if(pat[j] == pat[k]) ++k;
+            m->fail[i][j] = k;
+        }
+    }
+}
+
+static bool matcher_started(const matcher *m, const char *const *p, int count)
+{
+    if(m->count != count) return false;
+    for(int i = 0; i < count; ++i) {
+        if(m->pat[i] != p[i]) return false;
+    }
+    return true;
+}
+
+/* Feed a character to the matcher. Returns the index of the first string that
+ * was completed by the character or -1. Completed fields are not returned */
+static int matcher_step(matcher *m, char c)
+{
+    int result = -1;
+
+    if(m->in_field) {
+        if(isdigit((int) c)) m->value = m->value * 10 + c - '0';
+        else m->in_field = false;
+    }
+    for(int i = 0; i < m->count; ++i) {
+        const char *pat = m->pat[i];
+        int k = m->matched[i];
+        while(k > 0 && pat[k] != c) k = m->fail[i][k - 1];
+        if(pat[k] == c) ++k;
+        if(k == m->len[i]) {
+            if(pat[k - 1] == ':') {
+                // +CIPSTATUS lines after STATUS: must not overwrite the status
+                if(!m->has_value) m->in_field = m->has_value = true;
+            }
+            else if(result < 0) result = i;
+            k = m->fail[i][k - 1];
+        }
+        m->matched[i] = k;
+    }
+    return result;
+}
+
+static int pattern_count(const char **p)
+{
+    int count = 0;
+    while(p[count] != NULL) ++count;
+    return count;
 }
 
 /* Read and store characters upto specified length. 
@@ -250,7 +543,7 @@ void init_counters(smi *ctx) {
 void sm_flush(smi *ctx) 
 {
     //DEBUGP("flush: %d\n", (int)xSerialRxWaiting(ctx->ComPort));
-    while(serial_get_char(ctx, ctx->buffer));
+    while(sm_get_char(ctx, ctx->buffer));
 }
 
 
@@ -258,7 +551,7 @@ void sm_flush(smi *ctx)
  * Returns true when specified amount of characters have been accumulated. */
 bool sm_read_buffer(smi *ctx, int count) 
 {
-    while(ctx->pos < (SMI_BUFSIZE - 1) && ctx->pos < count && serial_get_char(ctx, ctx->buffer + ctx->pos)) {
+    while(ctx->pos < (SMI_BUFSIZE - 1) && ctx->pos < count && sm_get_char(ctx, ctx->buffer + ctx->pos)) {
         //putchar(ctx->buffer[ctx->pos]); // debugging
         ++ctx->pos;
     }
@@ -271,7 +564,7 @@ bool sm_read_buffer(smi *ctx, int count)
 bool sm_read_int(smi *ctx, int *value) 
 {
     bool result = false;
-    while(ctx->pos < (SMI_BUFSIZE - 1) && serial_get_char(ctx, ctx->buffer + ctx->pos)) {
+    while(ctx->pos < (SMI_BUFSIZE - 1) && sm_get_char(ctx, ctx->buffer + ctx->pos)) {
         if(!isdigit((int)ctx->buffer[ctx->pos])) {
             ctx->buffer[ctx->pos] = '\0';
             *value = atoi(ctx->buffer);
@@ -287,19 +580,27 @@ bool sm_read_int(smi *ctx, int *value)
 
 
 
-/* Read and store data until one of the specified strings is received.
- * The matched string is also included in the data .*/
+/* Read data until one of the specified strings is received. The list ends with NULL.
+ * Beginning of the response is stored in the buffer; the rest is only matched.
+ * Returns the index of the string or RC_NOT_AVAILABLE */
 int sm_read_until(smi *ctx, const char **p) 
 {
     int result = RC_NOT_AVAILABLE;
-    while(result < 0 && ctx->pos < (SMI_BUFSIZE - 1) && serial_get_char(ctx, ctx->buffer + ctx->pos)) {
-        ++ctx->pos;
-        ctx->buffer[ctx->pos] = '\0';
-        for(int i = 0; result < 0 && p[i] != NULL; ++i) {
-            if(strstr(ctx->buffer, p[i]) != NULL) {
-                result = i;
-            }
+    int count = pattern_count(p);
+    char c;
+
+    if(!matcher_started(&ctx->match, p, count)) matcher_start(&ctx->match, p, count);
+    while(result < 0 && sm_get_char(ctx, &c)) {
+        if(ctx->pos < SMI_BUFSIZE - 1) {
+            ctx->buffer[ctx->pos++] = c;
+            ctx->buffer[ctx->pos] = '\0';
         }
+        result = matcher_step(&ctx->match, c);
+    }
+    if(result >= 0) {
+        // next response starts from the beginning
+        ctx->pos = 0;
+        ctx->match.count = 0;
     }
     return result;
     
@@ -315,21 +616,16 @@ int sm_read_result(smi *ctx)
 /* read and consume characters until specified string occurs */
 bool sm_wait_for(smi *ctx, const char *p)
 {
-    bool result = false;
-    int len = strlen(p);
+    char c;
 
-    while(sm_read_buffer(ctx, len)) {
-        ctx->buffer[ctx->pos] = '\0';
-        if(strstr(ctx->buffer, p) != NULL) {
-            result = true;
-            break;
-        }
-        else {
-            memmove(ctx->buffer, ctx->buffer + 1, ctx->pos);
-            --ctx->pos;
+    if(!matcher_started(&ctx->match, &p, 1)) matcher_start(&ctx->match, &p, 1);
+    while(sm_get_char(ctx, &c)) {
+        if(matcher_step(&ctx->match, c) == 0) {
+            ctx->match.count = 0;
+            return true;
         }
     }
-    return result;
+    return false;
 }
 
 static void stInit(smi *ctx, const event *e)
@@ -337,6 +633,8 @@ static void stInit(smi *ctx, const event *e)
 	switch(e->ev) {
 	case eEnter:
         DEBUGP("stInit\r\n");
+        // module may have been reset: CIPMUX and CWMODE are back to their defaults
+        ctx->configured = false;
         sm_flush(ctx);
         init_counters(ctx);
         serial_write_str(ctx, "AT\r\n");
@@ -415,7 +713,8 @@ static void stEchoOff(smi *ctx, const event *e)
 		break;
     case eReceive:
         if(sm_wait_for(ctx, "OK\r\n")) {
-            TRAN(stStationModeCheck);
+            // module may still be joined to the access point from an earlier run
+            TRAN(stStatus);
         }
         break;
 	default:
@@ -426,6 +725,7 @@ static void stEchoOff(smi *ctx, const event *e)
 
 static void stStationModeCheck(smi *ctx, const event *e)
 {
+    static const char *mode_result[] = { "OK\r\n", "ERROR\r\n", "+CWMODE_CUR:", NULL };
     int rc = -1;
 	switch(e->ev) {
 	case eEnter:
@@ -438,10 +738,10 @@ static void stStationModeCheck(smi *ctx, const event *e)
 	case eTick:
 		break;
     case eReceive:
-        rc = sm_read_result(ctx);
+        rc = sm_read_until(ctx, mode_result);
         if(rc == RC_OK) {
             //DEBUGP("%d: %s", rc, ctx->buffer);
-            if(strstr(ctx->buffer, "+CWMODE_CUR:1\r\n") != NULL) {
+            if(ctx->match.value == 1) {
                 TRAN(stConnectAP);
             }
             else {
@@ -479,13 +779,19 @@ static void stStationModeSet(smi *ctx, const event *e)
 	}
 }
 
+/* segment of a constant string */
+#define SEG(s) { s, sizeof(s) - 1 }
+
 static void connect_ssid(smi *ctx) 
 {
-    serial_write_str(ctx, "AT+CWJAP_CUR=\"");
-    serial_write_str(ctx, ctx->ssid);
-    serial_write_str(ctx, "\",\"");
-    serial_write_str(ctx, ctx->pwd);
-    serial_write_str(ctx, "\"\r\n");
+    const serial_segment cmd[] = {
+        SEG("AT+CWJAP_CUR=\""),
+        { ctx->ssid, (int) strlen(ctx->ssid) },
+        SEG("\",\""),
+        { ctx->pwd, (int) strlen(ctx->pwd) },
+        SEG("\"\r\n")
+    };
+    serial_writev(ctx, cmd, sizeof(cmd) / sizeof(cmd[0]));
 }
 
 static void stConnectAP(smi *ctx, const event *e)
@@ -512,7 +818,7 @@ static void stConnectAP(smi *ctx, const event *e)
         rc = sm_read_result(ctx);
         if(rc == RC_OK) {
             //DEBUGP("%d: %s", rc, ctx->buffer);
-            TRAN(stReady);
+            TRAN(stMux);
         }
         else if(rc == RC_ERROR) {
             // failed: what to do now?
@@ -524,6 +830,86 @@ static void stConnectAP(smi *ctx, const event *e)
 }
 
 
+/* Check if the module is joined to the access point (STATUS:2, 3 or 4) and take
+ * the shortest path to stReady. Used at start up and after a failed connect */
+static void stStatus(smi *ctx, const event *e)
+{
+    static const char *status_result[] = { "OK\r\n", "ERROR\r\n", "STATUS:", NULL };
+    int rc;
+	switch(e->ev) {
+	case eEnter:
+        DEBUGP("stStatus\r\n");
+        init_counters(ctx);
+        serial_write_str(ctx, "AT+CIPSTATUS\r\n");
+		break;
+	case eExit:
+		break;
+	case eTick:
+        ++ctx->timer;
+        if(ctx->timer >= 10) TRAN(ctx->configured ? stConnectAP : stStationModeCheck);
+		break;
+    case eReceive:
+        rc = sm_read_until(ctx, status_result);
+        if(rc < 0) break;
+        if(rc == RC_OK && ctx->match.value >= 2 && ctx->match.value <= 4) {
+            TRAN(ctx->configured ? stReady : stMux);
+        }
+        else {
+            TRAN(ctx->configured ? stConnectAP : stStationModeCheck);
+        }
+        break;
+	default:
+		break;
+	}
+}
+
+
+/* Multiple connection mode. Fails if a connection from an earlier run is
+ * still open, in which case it is closed first */
+static void stMux(smi *ctx, const event *e)
+{
+    int rc;
+	switch(e->ev) {
+	case eEnter:
+        DEBUGP("stMux\r\n");
+        init_counters(ctx);
+        serial_write_str(ctx, "AT+CIPMUX=1\r\n");
+		break;
+	case eExit:
+		break;
+	case eTick:
+        ++ctx->timer;
+        if(ctx->timer >= 50) {
+            ctx->configured = false;
+            TRAN(stInit);
+        }
+		break;
+    case eReceive:
+        rc = sm_read_result(ctx);
+        if(rc == RC_OK && ctx->count % 2 == 0) {
+            ctx->configured = true;
+            TRAN(stReady);
+        }
+        else if(rc >= 0 && ctx->count % 2 == 0) {
+            // connections left open by an earlier run: close all in multiple connection mode,
+            // then the one of single connection mode
+            ctx->pos = 0;
+            serial_write_str(ctx, ctx->count == 0 ? "AT+CIPCLOSE=5\r\n" : "AT+CIPCLOSE\r\n");
+            ++ctx->count;
+        }
+        else if(rc >= 0) {
+            // closed (or wasn't open): try again. Timer keeps running so that we don't loop forever
+            ctx->pos = 0;
+            serial_write_str(ctx, "AT+CIPMUX=1\r\n");
+            ++ctx->count;
+        }
+        break;
+	default:
+		break;
+	}
+}
+
+
 static void stReady(smi *ctx, const event *e)
 {
 	switch(e->ev) {
@@ -536,10 +922,18 @@ static void stReady(smi *ctx, const event *e)
 	case eTick:
 		break;
     case eReceive:
+        // +IPD and link closed messages are handled while reading, the rest is not for us
+        sm_flush(ctx);
         break;
     case eConnect:
         TRAN(stConnectTCP);
         break;
+    case eSend:
+        TRAN(stSend);
+        break;
+    case eDisconnect:
+        TRAN(stCloseTCP);
+        break;
 	default:
 		break;
 	}
@@ -550,41 +944,60 @@ static void stReady(smi *ctx, const event *e)
 
 static void connect_tcp(smi *ctx) 
 {
-    serial_write_str(ctx, "AT+CIPSTART=\"TCP\",\"");
-    serial_write_str(ctx, ctx->sa_data);
-    serial_write_str(ctx, "\",");
-    serial_write_str(ctx, ctx->sa_port);
-    serial_write_str(ctx, "\r\n");
+    const char link[2] = { (char) ('0' + ctx->req_link), '\0' };
+    const serial_segment cmd[] = {
+        SEG("AT+CIPSTART="),
+        { link, 1 },
+        SEG(",\"TCP\",\""),
+        { ctx->sa_data, (int) strlen(ctx->sa_data) },
+        SEG("\","),
+        { ctx->sa_port, (int) strlen(ctx->sa_port) },
+        SEG("\r\n")
+    };
+    serial_writev(ctx, cmd, sizeof(cmd) / sizeof(cmd[0]));
 }
 
 static void stConnectTCP(smi *ctx, const event *e)
 {
+    static const char *connect_result[] = { "OK\r\n", "ERROR\r\n", "ALREADY CONNECTED\r\n", NULL };
     int rc;
 	switch(e->ev) {
 	case eEnter:
         DEBUGP("stConnectTCP\r\n");
         init_counters(ctx);
+        strncpy(ctx->sa_data, ctx->req_data, sizeof(ctx->sa_data) - 1);
+        ctx->sa_data[sizeof(ctx->sa_data) - 1] = '\0';
+        port2str(ctx->req_len, ctx->sa_port);
         connect_tcp(ctx);
 		break;
 	case eExit:
 		break;
 	case eTick:
+        // DNS lookup and connection may take several seconds
+        ++ctx->timer;
+        if(ctx->timer >= 150) {
+            DEBUGP("Connect timeout\r\n");
+            complete(ctx, -1);
+        }
 		break;
     case eReceive:
-        rc = sm_read_result(ctx);
-        if(rc == RC_OK) {
-            //DEBUGP("%d: %s", rc, ctx->buffer);
-            if(strstr(ctx->buffer, "CONNECT\r\n") != NULL) {
-                TRAN(stPassthrough);
-            }
-            else {
-                // what else can we get with OK??
+        rc = sm_read_until(ctx, connect_result);
+        if(rc == RC_OK || rc == 2) {
+            // ERROR that follows ALREADY CONNECTED is flushed in stReady
+            ctx->links[ctx->req_link].connected = true;
+            if(ctx->lost_tick != 0) {
+                ctx->reconnect_ms = (get_ticks() - ctx->lost_tick) * portTICK_PERIOD_MS;
+                if(ctx->reconnect_ms > ctx->reconnect_max) ctx->reconnect_max = ctx->reconnect_ms;
+                ctx->lost_tick = 0;
+                DEBUGP("Reconnected in %lu ms\r\n", (unsigned long) ctx->reconnect_ms);
             }
+            complete(ctx, 0);
         }
         else if(rc == RC_ERROR) {
-            // failed: what to do now?
             DEBUGP("Connect failed\r\n");
-            connect_tcp(ctx);
+            complete(ctx, -1);
+            // access point may have been lost: rejoin if needed before the next request
+            TRAN(stStatus);
         }
         break;
 	default:
@@ -593,131 +1006,186 @@ static void stConnectTCP(smi *ctx, const event *e)
 }
 
 
-static void stPassthrough(smi *ctx, const event *e)
+/* Send data of a link in pieces of at most ESP_MAX_SEND characters */
+static void send_command(smi *ctx)
 {
+    char cmd[24];
+    ctx->count = ctx->req_len > ESP_MAX_SEND ? ESP_MAX_SEND : ctx->req_len;
+    snprintf(cmd, sizeof(cmd), "AT+CIPSEND=%d,%d\r\n", ctx->req_link, ctx->count);
+    serial_write_str(ctx, cmd);
+}
+
+/* Send did not complete: the link can't be used any more. If the module may still be
+ * waiting for the data, fill in the rest so that the next commands are not taken as data */
+static void send_failed(smi *ctx, int missing)
+{
+    static const char filler[64];
+    while(missing > 0) {
+        int n = missing < (int) sizeof(filler) ? missing : (int) sizeof(filler);
+        serial_write_buf(ctx, filler, n);
+        missing -= n;
+    }
+    DEBUGP("Send failed\r\n");
+    link_lost(ctx, ctx->req_link);
+    complete(ctx, -1);
+    TRAN(stResync);
+}
+
+static void stSend(smi *ctx, const event *e)
+{
+    static const char *prompt_result[] = { ">", "ERROR\r\n", NULL };
     int rc;
 	switch(e->ev) {
 	case eEnter:
-        DEBUGP("stPassthrough\r\n");
         init_counters(ctx);
-        serial_write_str(ctx, "AT+CIPMODE=1\r\n");
+        if(ctx->req_result < 0) ctx->req_result = 0; // first piece
+        send_command(ctx);
 		break;
 	case eExit:
 		break;
 	case eTick:
+        // prompt may still come: the module would take the next commands as data
+        ++ctx->timer;
+        if(ctx->timer >= 20) send_failed(ctx, ctx->count);
 		break;
     case eReceive:
-        rc = sm_read_result(ctx);
-        if(rc == RC_OK) {
-            TRAN(stPassthroughOK);
+        rc = sm_read_until(ctx, prompt_result);
+        if(rc == 0) {
+            serial_write_buf(ctx, ctx->req_data, ctx->count);
+            TRAN(stSendData);
         }
-        else if(rc == RC_ERROR) {
-            // failed: what to do now?
+        else if(rc > 0) {
+            // link is not open: module does not wait for data
+            send_failed(ctx, 0);
         }
         break;
 	default:
 		break;
 	}
-    
 }
 
-static void stPassthroughOK(smi *ctx, const event *e)
+static void stSendData(smi *ctx, const event *e)
 {
+    static const char *send_result[] = { "SEND OK\r\n", "SEND FAIL\r\n", "ERROR\r\n", NULL };
+    int rc;
+    int sent;
 	switch(e->ev) {
 	case eEnter:
-        DEBUGP("stPassthroughOK\r\n");
+        sent = ctx->count;
         init_counters(ctx);
-        serial_write_str(ctx, "AT+CIPSEND\r\n");
+        ctx->count = sent;
 		break;
 	case eExit:
 		break;
 	case eTick:
+        ++ctx->timer;
+        if(ctx->timer >= 50) send_failed(ctx, 0);
 		break;
     case eReceive:
-        if(sm_wait_for(ctx, ">")) {
-            TRAN(stConnected);
+        rc = sm_read_until(ctx, send_result);
+        if(rc == 0) {
+            ctx->req_result += ctx->count;
+            ctx->req_data += ctx->count;
+            ctx->req_len -= ctx->count;
+            if(ctx->req_len > 0) TRAN(stSend);
+            else complete(ctx, ctx->req_result);
+        }
+        else if(rc > 0) {
+            // SEND FAIL or ERROR: connection is gone
+            send_failed(ctx, 0);
         }
         break;
 	default:
 		break;
 	}
-    
 }
 
 
-static void stConnected(smi *ctx, const event *e)
+static void stCloseTCP(smi *ctx, const event *e)
 {
+    char cmd[20];
+    int rc = -1;
 	switch(e->ev) {
 	case eEnter:
-        DEBUGP("stConnected\r\n");
+        DEBUGP("stCloseTCP\r\n");
         init_counters(ctx);
+        snprintf(cmd, sizeof(cmd), "AT+CIPCLOSE=%d\r\n", ctx->req_link);
+        serial_write_str(ctx, cmd);
         break;
+	case eReceive:
+        rc = sm_read_result(ctx);
+        if(rc >= 0) {
+            // ERROR means that the link was already closed
+            link_lost(ctx, ctx->req_link);
+            complete(ctx, 0);
+        }
+		break;
 	case eExit:
 		break;
 	case eTick:
+        ++ctx->timer;
+        if(ctx->timer == 25) {
+            link_lost(ctx, ctx->req_link);
+            complete(ctx, 0);
+        }
 		break;
-    case eReceive:
-        break;
-    case eDisconnect:
-        TRAN(stCommandMode);
-        break;
 	default:
 		break;
 	}
-    
 }
 
 
-static void stCommandMode(smi *ctx, const event *e)
+
+/* Get back in sync with the module after a failed send */
+static void stResync(smi *ctx, const event *e)
 {
 	switch(e->ev) {
 	case eEnter:
-        DEBUGP("stCommandMode\r\n");
+        DEBUGP("stResync\r\n");
+        sm_flush(ctx);
         init_counters(ctx);
+        serial_write_str(ctx, "AT\r\n");
 		break;
 	case eExit:
 		break;
 	case eTick:
         ++ctx->timer;
-        if(ctx->timer == 10) serial_write_str(ctx, "+++");
-        if(ctx->timer == 25) TRAN(stCloseTCP);
+        if(ctx->timer >= 10) {
+            ctx->timer = 0;
+            ++ctx->count;
+            if(ctx->count < 5) serial_write_str(ctx, "AT\r\n");
+            else TRAN(stInit);
+        }
 		break;
     case eReceive:
+        if(sm_wait_for(ctx, "OK\r\n")) {
+            TRAN(stResyncClose);
+        }
         break;
 	default:
 		break;
 	}
 }
 
-
-static void stCloseTCP(smi *ctx, const event *e)
+/* Close the link of the failed send so that the next connect on it starts fresh.
+ * No request is waiting: the caller has already got the error */
+static void stResyncClose(smi *ctx, const event *e)
 {
-    int rc = -1;
+    char cmd[20];
 	switch(e->ev) {
 	case eEnter:
-        DEBUGP("stCloseTCP\r\n");
         init_counters(ctx);
-        serial_write_str(ctx, "AT+CIPMODE=0\r\n");;
+        snprintf(cmd, sizeof(cmd), "AT+CIPCLOSE=%d\r\n", ctx->req_link);
+        serial_write_str(ctx, cmd);
         break;
 	case eReceive:
-        rc = sm_read_result(ctx);
-        if(rc == RC_OK) {
-            if(strstr(ctx->buffer, "CLOSED") != NULL) {
-                TRAN(stReady);
-            }
-            else {
-                init_counters(ctx);
-                serial_write_str(ctx, "AT+CIPCLOSE\r\n");;
-            }
-        }
-        else if(rc == RC_ERROR) {
-        }
+        if(sm_read_result(ctx) >= 0) TRAN(stReady);
 		break;
 	case eExit:
 		break;
 	case eTick:
         ++ctx->timer;
-        if(ctx->timer == 25) TRAN(stCommandMode);
+        if(ctx->timer == 25) TRAN(stReady);
 		break;
 	default:
 		break;
@@ -738,6 +1206,13 @@ static void dispatch_event(smi *ctx, const event *e)
 
 
 
+/* Tell the waiting callers the state we are in */
+static void publish_state(smi *ctx)
+{
+	if(ctx->state == stReady) xEventGroupSetBits(ctx->events, ESP_READY_BIT);
+	else xEventGroupClearBits(ctx->events, ESP_READY_BIT);
+}
+
 /**
  * Receive events from queue and dispatch them to state machine
  */
@@ -748,23 +1223,49 @@ static void EspSocketRun(smi *ctx)
 	static uint32_t old = 0 ;
     uint32_t now = 0 ;
 
-	now = get_ticks()/100;
+	now = get_ticks()/ESP_TICK_MS;
 	if(now != old) {
 	    const event tick = { eTick };
 		old = now;
 		// send ESP tick
-		RingBuffer_Insert(&ctx->EspEventQ, &tick);
+		xQueueSend(ctx->EspEventQ, &tick, 0);
 	}
 
 	if(serial_peek(ctx)) {
 	    const event rcv = { eReceive };
-		RingBuffer_Insert(&ctx->EspEventQ, &rcv);
+		xQueueSend(ctx->EspEventQ, &rcv, 0);
 	}
 
 	// read queue
-	while (RingBuffer_Pop(&ctx->EspEventQ,&e)) {
+	while (xQueueReceive(ctx->EspEventQ, &e, 0) == pdTRUE) {
 		dispatch_event(ctx, &e); // dispatch event to current state
 	}
+	publish_state(ctx);
+}
+
+/**
+ * State machine task. Sleeps until characters are received, an event is posted or it is time for the next tick
+ */
+static void EspSocketTask(void *pvParameters)
+{
+	smi *ctx = (smi *) pvParameters;
+	const TickType_t period = pdMS_TO_TICKS(ESP_TICK_MS);
+
+	ctx->state(ctx, &evEnter); // enter initial state
+	publish_state(ctx);
+
+	for(;;) {
+		TickType_t timeout = period - get_ticks() % period;
+		if(ctx->unread > 0 && serial_peek(ctx) == ctx->unread) {
+			// the state left data unread: wait for the tick or an event only so that we don't spin on the same data
+			ulTaskNotifyTake(pdTRUE, timeout);
+		}
+		else {
+			serial_wait(ctx, timeout);
+		}
+		EspSocketRun(ctx);
+		ctx->unread = serial_peek(ctx);
+	}
 }
 
 
@@ -1,6 +1,8 @@
 #ifndef ESP8266_H_
 #define ESP8266_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -13,6 +15,9 @@ int esp_write(int sockfd, const void *data, int length);
 int esp_close(int sockfd);
 int esp_shutdown(int sockfd, int how);
 int esp_peek(int sockfd);
+/* Time from the loss of a connection to the next successful connect in milliseconds.
+ * Returns the last measurement and stores the longest one to max_ms if it is not NULL */
+uint32_t esp_reconnect_ms(uint32_t *max_ms);
 
 #ifdef __cplusplus
 }
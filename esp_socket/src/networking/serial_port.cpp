@@ -12,6 +12,9 @@ extern "C" {
 #endif
 
 static LpcUart *EspUart;
+/* ESP8266 sends bursts of up to a full TCP segment at 115200 so it gets a larger receive buffer */
+static uint8_t esp_rx[1024];
+static uint8_t esp_tx[256];
 
 void serial_init(void *ctx)
 {
@@ -19,7 +22,9 @@ void serial_init(void *ctx)
 		LpcPinMap none = {-1, -1}; // unused pin has negative values in it
 		LpcPinMap txpin_esp = { 0, 8 }; // transmit pin
 		LpcPinMap rxpin_esp = { 1, 6 }; // receive pin
-		LpcUartConfig cfg = { LPC_USART2, 115200, UART_CFG_DATALEN_8 | UART_CFG_PARITY_NONE | UART_CFG_STOPLEN_1, false, txpin_esp, rxpin_esp, none, none };
+		LpcUartConfig cfg = { LPC_USART2, 115200, UART_CFG_DATALEN_8 | UART_CFG_PARITY_NONE | UART_CFG_STOPLEN_1, false, txpin_esp, rxpin_esp, none, none,
+				true, true, // DMA in both directions
+				esp_rx, sizeof(esp_rx), esp_tx, sizeof(esp_tx) };
 
 		EspUart = new LpcUart(cfg);
 	}
@@ -35,6 +40,12 @@ void serial_write_str(void *ctx, const char *s)
 	EspUart->write(s);
 }
 
+void serial_writev(void *ctx, const serial_segment *seg, int count)
+{
+	static_assert(sizeof(serial_segment) == sizeof(LpcUartSegment), "segment layouts must match");
+	EspUart->writev(reinterpret_cast<const LpcUartSegment *>(seg), count);
+}
+
 int serial_read_buf(void *ctx, char *buf, int len)
 {
 	return EspUart->read(buf, len, 20 * len);
@@ -50,6 +61,11 @@ int serial_peek(void *ctx)
 	return EspUart->peek();
 }
 
+int serial_wait(void *ctx, uint32_t timeout)
+{
+	return EspUart->wait(timeout);
+}
+
 #ifdef __cplusplus
 }
 #endif
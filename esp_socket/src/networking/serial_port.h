@@ -8,17 +8,27 @@
 #ifndef SERIAL_PORT_H_
 #define SERIAL_PORT_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
+/* part of a message for serial_writev() */
+typedef struct serial_segment_ {
+	const char *data;
+	int len;
+} serial_segment;
+
 void serial_init(void *ctx);
 void serial_write_buf(void *ctx, const char *buf, int len);
 void serial_write_str(void *ctx, const char *s);
+void serial_writev(void *ctx, const serial_segment *seg, int count); /* write segments as one message */
 int  serial_read_buf(void *ctx, char *buf, int len);
 int  serial_get_char(void *ctx, char *p);
 int  serial_peek(void *ctx);
+int  serial_wait(void *ctx, uint32_t timeout); /* sleep until data is received, timeout in ticks. Returns true if data is available */
 
 #ifdef __cplusplus
 }
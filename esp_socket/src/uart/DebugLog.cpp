@@ -0,0 +1,167 @@
+/*
+ * DebugLog.cpp
+ *
+ *  Created on: 18.10.2026
+ */
+
+#include <cstdio>
+#include "DebugLog.h"
+
+/* Record in the ring buffer: a header byte that is the number of argument words,
+ * the format string pointer and the argument words. Text records have header
+ * TextRecord followed by a two byte length and the characters. */
+static const uint8_t TextRecord = 0xFF;
+
+LpcUart *DebugLog::uart = nullptr;
+TaskHandle_t DebugLog::handle = nullptr;
+SpscRing DebugLog::ring;
+uint8_t DebugLog::storage[RingSize];
+volatile uint32_t DebugLog::lost = 0;
+
+void DebugLog::begin(LpcUart *u, UBaseType_t priority) {
+	if(uart) return;
+	uart = u;
+	ring.init(storage, RingSize);
+	// stack must hold the line buffer and the floating point formatting of snprintf
+	xTaskCreate(task, "log", configMINIMAL_STACK_SIZE * 4, nullptr, priority, &handle);
+}
+
+/* The log task sleeps while the ring is empty: the record that ends that needs to wake it */
+void DebugLog::wake(bool was_empty) {
+	if(was_empty && handle) xTaskNotifyGive(handle);
+}
+
+void DebugLog::put(const char *fmt, const uint32_t *words, int count) {
+	uint8_t n = count;
+	uint32_t size = 1 + sizeof(fmt) + count * sizeof(uint32_t);
+
+	// tasks share the producer side of the ring: a short critical section makes the record atomic
+	taskENTER_CRITICAL();
+	bool was_empty = ring.empty();
+	if(ring.space() >= size) {
+		ring.put(&n, 1);
+		ring.put((const uint8_t *) &fmt, sizeof(fmt));
+		ring.put((const uint8_t *) words, count * sizeof(uint32_t));
+	}
+	else {
+		++lost;
+	}
+	taskEXIT_CRITICAL();
+	wake(was_empty);
+}
+
+void DebugLog::text(const char *s) {
+	uint16_t len = strlen(s);
+	uint8_t header = TextRecord;
+
+	taskENTER_CRITICAL();
+	bool was_empty = ring.empty();
+	if(ring.space() >= 3u + len) {
+		ring.put(&header, 1);
+		ring.put((const uint8_t *) &len, sizeof(len));
+		ring.put((const uint8_t *) s, len);
+	}
+	else {
+		++lost;
+	}
+	taskEXIT_CRITICAL();
+	wake(was_empty);
+}
+
+uint32_t DebugLog::dropped() {
+	return lost;
+}
+
+/* Format one message. Each conversion is formatted with snprintf separately
+ * so that the arguments can be passed with their original types. */
+int DebugLog::format(const char *fmt, const uint32_t *words, char *out, int size) {
+	int len = 0;
+	char spec[16];
+
+	while(*fmt && len < size - 1) {
+		if(*fmt != '%') {
+			out[len++] = *fmt++;
+			continue;
+		}
+		// copy flags, width, precision and length up to the conversion character
+		int i = 0;
+		int longs = 0;
+		spec[i++] = *fmt++;
+		while(*fmt && !strchr("diouxXcsfFeEgGaAp%", *fmt) && i < (int) sizeof(spec) - 2) {
+			if(*fmt == 'l') ++longs;
+			spec[i++] = *fmt++;
+		}
+		if(!*fmt) break;
+		char conv = *fmt++;
+		spec[i++] = conv;
+		spec[i] = '\0';
+
+		int left = size - len;
+		int n;
+		switch(conv) {
+		case '%':
+			n = snprintf(out + len, left, "%%");
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+			double d;
+			memcpy(&d, words, sizeof(d));
+			words += 2;
+			n = snprintf(out + len, left, spec, d);
+			break;
+		}
+		case 's':
+			n = snprintf(out + len, left, spec, (const char *) (uintptr_t) *words++);
+			break;
+		case 'p':
+			n = snprintf(out + len, left, spec, (void *) (uintptr_t) *words++);
+			break;
+		default:
+			if(longs >= 2) {
+				long long ll;
+				memcpy(&ll, words, sizeof(ll));
+				words += 2;
+				n = snprintf(out + len, left, spec, ll);
+			}
+			else if(longs == 1) {
+				n = snprintf(out + len, left, spec, (long) *words++);
+			}
+			else {
+				n = snprintf(out + len, left, spec, (int) *words++);
+			}
+			break;
+		}
+		len += (n < left) ? n : left - 1;
+	}
+	out[len] = '\0';
+	return len;
+}
+
+void DebugLog::task(void *pvParameters) {
+	(void) pvParameters;
+	char line[160];
+	uint32_t words[2 * MaxArgs];
+
+	while(true) {
+		uint8_t header;
+		if(!ring.get(header)) {
+			// nothing to print: sleep until a producer adds a record to the empty ring
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			continue;
+		}
+		if(header == TextRecord) {
+			uint16_t len;
+			ring.get((uint8_t *) &len, sizeof(len));
+			while(len > 0) {
+				int n = ring.get((uint8_t *) line, len < sizeof(line) ? len : sizeof(line));
+				uart->write(line, n);
+				len -= n;
+			}
+		}
+		else {
+			const char *fmt;
+			ring.get((uint8_t *) &fmt, sizeof(fmt));
+			ring.get((uint8_t *) words, header * sizeof(uint32_t));
+			uart->write(line, format(fmt, words, line, sizeof(line)));
+		}
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ * DebugLog.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Deferred printf style logging. log() stores the format string pointer and
+ *  the arguments in binary into a ring buffer and returns; a low priority task
+ *  formats the messages and writes them to the UART. The format string and
+ *  strings passed for %s must stay valid until the message has been printed,
+ *  so use string literals or use text() which copies the text.
+ *
+ *    DebugLog::begin(dbgu);
+ *    DebugLog::log("CO2 level (ppm): %d\r\n", co2);
+ *
+ *  Supported conversions are those of printf without * width or precision.
+ *  Messages that don't fit in the ring buffer are dropped and counted.
+ *  Call from tasks only.
+ */
+
+#ifndef DEBUGLOG_H_
+#define DEBUGLOG_H_
+
+#include <stdint.h>
+#include <cstring>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "LpcUart.h"
+#include "SpscRing.h"
+
+class DebugLog {
+public:
+	static const int RingSize = 1024; /* power of two */
+	static const int MaxArgs = 8;
+
+	static void begin(LpcUart *uart, UBaseType_t priority = tskIDLE_PRIORITY + 1);
+
+	template<typename... Args> static void log(const char *fmt, Args... args) {
+		static_assert(sizeof...(Args) <= MaxArgs, "too many arguments");
+		uint32_t words[2 * sizeof...(Args) + 1]; // doubles and long longs take two words
+		int n = 0;
+		pack(words, n, args...);
+		put(fmt, words, n);
+	}
+	static void text(const char *s); /* copy a preformatted text */
+	static uint32_t dropped(); /* number of messages that did not fit in the buffer */
+
+private:
+	static void pack(uint32_t *, int &) {}
+	template<typename T, typename... Rest> static void pack(uint32_t *w, int &n, T v, Rest... rest) {
+		store(w, n, v);
+		pack(w, n, rest...);
+	}
+	// arguments are stored the way printf receives them after the default promotions
+	static void store(uint32_t *w, int &n, int v) { w[n++] = (uint32_t) v; }
+	static void store(uint32_t *w, int &n, unsigned int v) { w[n++] = v; }
+	static void store(uint32_t *w, int &n, long v) { w[n++] = (uint32_t) v; }
+	static void store(uint32_t *w, int &n, unsigned long v) { w[n++] = (uint32_t) v; }
+	static void store(uint32_t *w, int &n, long long v) { memcpy(w + n, &v, 8); n += 2; }
+	static void store(uint32_t *w, int &n, unsigned long long v) { memcpy(w + n, &v, 8); n += 2; }
+	static void store(uint32_t *w, int &n, double v) { memcpy(w + n, &v, 8); n += 2; }
+	static void store(uint32_t *w, int &n, const void *v) { w[n++] = (uint32_t) (uintptr_t) v; }
+
+	static void put(const char *fmt, const uint32_t *words, int count);
+	static void task(void *pvParameters);
+	static int format(const char *fmt, const uint32_t *words, char *out, int size);
+
+	static void wake(bool was_empty);
+
+	static LpcUart *uart;
+	static TaskHandle_t handle;
+	static SpscRing ring;
+	static uint8_t storage[RingSize];
+	static volatile uint32_t lost;
+};
+
+#endif /* DEBUGLOG_H_ */
@@ -14,6 +14,11 @@ static LpcUart *u0;
 static LpcUart *u1;
 static LpcUart *u2;
 
+/* DMA descriptors must be 16 byte aligned so they can't be members of a heap allocated object.
+ * Each UART has two descriptors for the circular receive buffer and one for a wrapping transmit. */
+static DMA_CHDESC_T dma_desc[3][3] __attribute__ ((aligned(16)));
+static bool dma_init = false;
+
 extern "C" {
 /**
  * @brief	UART interrupt handler using ring buffers
@@ -52,20 +57,304 @@ void UART2_IRQHandler(void)
 	portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 }
 
+/**
+ * @brief	DMA interrupt handler. All UART channels share the same interrupt
+ * @return	Nothing
+ */
+void DMA_IRQHandler(void)
+{
+	portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+
+	if(u0) u0->dma_isr(&xHigherPriorityTaskWoken);
+	if(u1) u1->dma_isr(&xHigherPriorityTaskWoken);
+	if(u2) u2->dma_isr(&xHigherPriorityTaskWoken);
+
+	portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
+}
+
+}
+
+
+void LpcUart::dma_isr(portBASE_TYPE *hpw) {
+	if(!dma_tx && !dma_rx) return;
+
+	uint32_t active = Chip_DMA_GetActiveIntAChannels(LPC_DMA);
+
+	if(dma_tx && (active & (1 << dma_tx_ch))) {
+		Chip_DMA_ClearActiveIntAChannel(LPC_DMA, dma_tx_ch);
+		// the whole transfer is done: release the space and send what was added meanwhile
+		txring.set_tail(txring.tail_index() + dma_tx_len);
+		dma_tx_len = 0;
+		dma_tx_start();
+		if(notify_tx) vTaskNotifyGiveFromISR(notify_tx, hpw);
+	}
+
+	if(dma_rx && (active & (1 << dma_rx_ch))) {
+		Chip_DMA_ClearActiveIntAChannel(LPC_DMA, dma_rx_ch);
+		// DMA continues to the other half of the buffer without our help
+		++dma_rx_halves;
+		if(notify_rx) vTaskNotifyGiveFromISR(notify_rx, hpw);
+		if(on_receive) on_receive();
+	}
+}
+
+/* Start transmitting the contents of the transmit ring buffer. The data is not removed from
+ * the ring buffer until the transfer is done so that the space is not overwritten.
+ * Must be called from the DMA ISR or with the DMA interrupt masked. */
+void LpcUart::dma_tx_start() {
+	uint32_t count = txring.count();
+	if(dma_tx_len || count == 0) return;
+	if(count > 1024) count = 1024; // transfer count of the two descriptors together
+
+	uint32_t tail = txring.tail_index() & (txring.size() - 1);
+	uint32_t first = txring.size() - tail;
+	if(first > count) first = count;
+	uint32_t second = count - first;
+
+	uint32_t xfercfg = DMA_XFERCFG_CFGVALID | DMA_XFERCFG_SWTRIG | DMA_XFERCFG_WIDTH_8 |
+			DMA_XFERCFG_SRCINC_1 | DMA_XFERCFG_DSTINC_0;
+	DMA_CHDESC_T desc;
+	desc.source = DMA_ADDR(txbuff + tail + first - 1);
+	desc.dest = DMA_ADDR(&uart->TXDATA);
+	desc.next = 0;
+	if(second) {
+		// data wraps around the end of the buffer: chain the beginning of the buffer
+		DMA_CHDESC_T *wrap = &dma_desc[index][2];
+		wrap->xfercfg = xfercfg | DMA_XFERCFG_SETINTA | DMA_XFERCFG_XFERCOUNT(second);
+		wrap->source = DMA_ADDR(txbuff + second - 1);
+		wrap->dest = DMA_ADDR(&uart->TXDATA);
+		wrap->next = 0;
+		desc.next = DMA_ADDR(wrap);
+		xfercfg |= DMA_XFERCFG_RELOAD;
+	}
+	else {
+		xfercfg |= DMA_XFERCFG_SETINTA;
+	}
+	desc.xfercfg = xfercfg | DMA_XFERCFG_XFERCOUNT(first);
+
+	dma_tx_len = count;
+	Chip_DMA_SetupTranChannel(LPC_DMA, dma_tx_ch, &desc);
+	Chip_DMA_SetupChannelTransfer(LPC_DMA, dma_tx_ch, desc.xfercfg);
+	Chip_DMA_SetValidChannel(LPC_DMA, dma_tx_ch);
+}
+
+/* Update receive ring buffer head from the DMA transfer position */
+void LpcUart::dma_rx_sync() {
+	const uint32_t size = rxring.size();
+	const uint32_t half = size / 2;
+	const uint32_t bit = 1 << dma_rx_ch;
+
+	taskENTER_CRITICAL();
+	uint32_t pending;
+	uint32_t remaining;
+	// a half may complete between the reads: repeat until we have a consistent pair
+	do {
+		pending = LPC_DMA->DMACOMMON[0].INTA & bit;
+		remaining = (LPC_DMA->DMACH[dma_rx_ch].XFERCFG >> 16) & 0x3FF;
+	} while(pending != (LPC_DMA->DMACOMMON[0].INTA & bit));
+
+	uint32_t halves = dma_rx_halves + (pending ? 1 : 0);
+	// 0x3FF means that the descriptor is exhausted and the next one has not been loaded yet
+	uint32_t done = (remaining == 0x3FF) ? 0 : half - (remaining + 1);
+	uint32_t head = halves * half + done;
+
+	// DMA does not stop when the buffer is full: the oldest data may have been overwritten.
+	// Only the reader moves the tail, see rx_get()
+	uint32_t count = head - rxring.tail_index();
+	rxring.set_head(head);
+	rx_level(count > size ? size : count);
+	taskEXIT_CRITICAL();
+}
+
+/* Take received characters from the ring buffer. With DMA receive the characters that
+ * the DMA has overwritten are skipped first. Call with read_mutex held */
+int LpcUart::rx_get(uint8_t *buffer, int len) {
+	if(dma_rx) {
+		const uint32_t size = rxring.size();
+		uint32_t head = rxring.head_index();
+		uint32_t count = head - rxring.tail_index();
+		if(count > size) {
+			rx_overflow += count - size;
+			rxring.set_tail(head - size);
+		}
+	}
+	return rxring.get(buffer, len);
+}
+
+/* Wait for more received characters. Returns false on timeout.
+ * With DMA receive there is no interrupt per character so the start bit interrupt wakes us
+ * up and the DMA position is polled until the character has been stored. This takes at most
+ * one character time, which is much less than a tick at the speeds we use. */
+bool LpcUart::wait_rx(TickType_t timeout) {
+	if(!dma_rx) {
+		bool woken = ulTaskNotifyTake(pdTRUE, timeout) != 0;
+		if(woken) wake_latency();
+		return woken;
+	}
+
+	uint32_t head = rxring.head_index();
+	Chip_UART_ClearStatus(uart, UART_STAT_START);
+	Chip_UART_IntEnable(uart, UART_INTEN_START);
+	// a character that started before the interrupt was enabled does not wake us up
+	bool woken = !(Chip_UART_GetStatus(uart) & UART_STAT_RXIDLE);
+	if(!woken) {
+		woken = ulTaskNotifyTake(pdTRUE, timeout) != 0;
+		if(woken) wake_latency();
+	}
+	Chip_UART_IntDisable(uart, UART_INTEN_START);
+	if(woken) {
+		// receiver goes idle at the stop bit and the DMA moves the character right after that.
+		// The tick limit covers a start bit that was only noise or a line held in break.
+		TickType_t start = xTaskGetTickCount();
+		bool idle;
+		do {
+			idle = Chip_UART_GetStatus(uart) & UART_STAT_RXIDLE;
+			dma_rx_sync();
+		} while(rxring.head_index() == head && !idle && xTaskGetTickCount() - start < 2);
+	}
+	dma_rx_sync();
+
+	return rxring.head_index() != head;
+}
+
+void LpcUart::dma_setup() {
+	if(!dma_init) {
+		dma_init = true;
+		Chip_DMA_Init(LPC_DMA);
+		Chip_DMA_Enable(LPC_DMA);
+		Chip_DMA_SetSRAMBase(LPC_DMA, DMA_ADDR(Chip_DMA_Table));
+		NVIC_SetPriority(DMA_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
+		NVIC_EnableIRQ(DMA_IRQn);
+	}
+
+	// USART DMA requests are in rx/tx pairs in UART order
+	dma_rx_ch = (DMA_CHID_T) (DMAREQ_USART0_RX + 2 * index);
+	dma_tx_ch = (DMA_CHID_T) (DMAREQ_USART0_TX + 2 * index);
+
+	if(dma_tx) {
+		Chip_DMA_EnableChannel(LPC_DMA, dma_tx_ch);
+		Chip_DMA_EnableIntChannel(LPC_DMA, dma_tx_ch);
+		Chip_DMA_SetupChannelConfig(LPC_DMA, dma_tx_ch, DMA_CFG_PERIPHREQEN | DMA_CFG_TRIGBURST_SNGL | DMA_CFG_CHPRIORITY(3));
+	}
+
+	if(dma_rx) {
+		// receive buffer is used as two halves that the DMA fills in turns forever
+		const uint32_t half = rxring.size() / 2;
+		uint32_t xfercfg = DMA_XFERCFG_CFGVALID | DMA_XFERCFG_RELOAD | DMA_XFERCFG_SETINTA | DMA_XFERCFG_WIDTH_8 |
+				DMA_XFERCFG_SRCINC_0 | DMA_XFERCFG_DSTINC_1 | DMA_XFERCFG_XFERCOUNT(half);
+		DMA_CHDESC_T *a = &dma_desc[index][0];
+		DMA_CHDESC_T *b = &dma_desc[index][1];
+		a->xfercfg = xfercfg;
+		a->source = DMA_ADDR(&uart->RXDATA);
+		a->dest = DMA_ADDR(rxbuff + half - 1);
+		a->next = DMA_ADDR(b);
+		b->xfercfg = xfercfg;
+		b->source = DMA_ADDR(&uart->RXDATA);
+		b->dest = DMA_ADDR(rxbuff + rxring.size() - 1);
+		b->next = DMA_ADDR(a);
+
+		Chip_DMA_EnableChannel(LPC_DMA, dma_rx_ch);
+		Chip_DMA_EnableIntChannel(LPC_DMA, dma_rx_ch);
+		Chip_DMA_SetupChannelConfig(LPC_DMA, dma_rx_ch, DMA_CFG_PERIPHREQEN | DMA_CFG_TRIGBURST_SNGL | DMA_CFG_CHPRIORITY(1));
+		Chip_DMA_SetupTranChannel(LPC_DMA, dma_rx_ch, a);
+		Chip_DMA_SetupChannelTransfer(LPC_DMA, dma_rx_ch, xfercfg | DMA_XFERCFG_SWTRIG);
+		Chip_DMA_SetValidChannel(LPC_DMA, dma_rx_ch);
+	}
 }
 
+/* Count line errors and report them to the error callback. The flags are cleared so that
+ * the next error is counted separately */
+void LpcUart::line_errors(uint32_t stat, portBASE_TYPE *hpw) {
+	uint32_t errors = stat & LPC_UART_ERRORS;
+	Chip_UART_ClearStatus(uart, errors);
+
+	if(errors & UART_STAT_FRM_ERRINT) ++err_framing;
+	if(errors & UART_STAT_PAR_ERRINT) ++err_parity;
+	if(errors & UART_STAT_RXNOISEINT) ++err_noise;
+	if(errors & UART_STAT_OVERRUNINT) ++err_overrun;
+	if(errors & UART_STAT_DELTARXBRK) {
+		// break start and end both change the state: count the start only
+		if(stat & UART_STAT_RXBRK) {
+			++err_breaks;
+			rx_break = true;
+		}
+		else {
+			errors &= ~UART_STAT_DELTARXBRK;
+		}
+	}
+
+	if(errors && error_cb) error_cb(error_cb_arg, errors, hpw);
+}
 
 void LpcUart::isr(portBASE_TYPE *hpw) {
+	uint32_t start = DWT->CYCCNT;
+	uint32_t moved = 0;
 	// get interrupt status for notifications
 	uint32_t istat = Chip_UART_GetIntStatus(uart);
 
-	// chip library is used to handle receive and transmit
-	Chip_UART_IRQRBHandler(uart, &rxring, &txring);
+	// receive hook takes the characters before the chip library puts them in the ring buffer
+	if(rx_hook) {
+		while(Chip_UART_GetStatus(uart) & UART_STAT_RXRDY) {
+			rx_hook(rx_hook_arg, (uint8_t) Chip_UART_ReadByte(uart), hpw);
+		}
+	}
+
+	// receive and transmit that are not done by DMA go through the ring buffers one character at a time
+	if(!dma_tx) {
+		uint8_t c;
+		while((Chip_UART_GetStatus(uart) & UART_STAT_TXRDY) && txring.get(c)) {
+			Chip_UART_SendByte(uart, c);
+			++moved;
+		}
+		// the task can't run between these lines so it can't add data after the check
+		if(txring.empty()) {
+			Chip_UART_IntDisable(uart, UART_INTEN_TXRDY);
+		}
+	}
+	if(!dma_rx) {
+		while(Chip_UART_GetStatus(uart) & UART_STAT_RXRDY) {
+			// characters that don't fit are dropped like the chip library does
+			if(!rxring.put((uint8_t) Chip_UART_ReadByte(uart))) ++rx_overflow;
+			++moved;
+		}
+		rx_level(rxring.count());
+	}
+
+	// line errors are reported after the character has been received so that it belongs to the frame being discarded
+	uint32_t stat = Chip_UART_GetStatus(uart);
+	if(stat & LPC_UART_ERRORS) line_errors(stat, hpw);
+
+	// start bit interrupt is enabled only while a reader waits for DMA receive
+	if(istat & UART_STAT_START) {
+		Chip_UART_IntDisable(uart, UART_INTEN_START);
+		Chip_UART_ClearStatus(uart, UART_STAT_START);
+		if(notify_rx) {
+			if(wake_stamp == 0) wake_stamp = DWT->CYCCNT | 1;
+			vTaskNotifyGiveFromISR(notify_rx, hpw);
+		}
+	}
 
 	// notify of the events handled
-	if(notify_rx && (istat & UART_STAT_RXRDY) ) vTaskNotifyGiveFromISR(notify_rx, hpw);
+	if(notify_rx && (istat & UART_STAT_RXRDY) ) {
+		if(wake_stamp == 0) wake_stamp = DWT->CYCCNT | 1; // zero means none
+		vTaskNotifyGiveFromISR(notify_rx, hpw);
+	}
 	if(notify_tx && (istat & UART_STAT_TXRDY) ) vTaskNotifyGiveFromISR(notify_tx, hpw);
 	if(on_receive && (istat & UART_STAT_RXRDY) ) on_receive();
+
+	isr_cycles += DWT->CYCCNT - start;
+	isr_chars += moved;
+}
+
+void LpcUart::wake_latency()
+{
+	uint32_t stamp = wake_stamp;
+	if(stamp == 0) return;
+	uint32_t cycles = DWT->CYCCNT - stamp;
+	wake_stamp = 0;
+	if(cycles > wake_max) wake_max = cycles;
+	wake_sum += cycles;
+	++wake_count;
 }
 
 bool LpcUart::init = false;
@@ -87,6 +376,9 @@ LpcUart::LpcUart(const LpcUartConfig &cfg) {
 		 * */
 		/* Use main clock rate as base for UART baud rate divider */
 		Chip_Clock_SetUARTBaseClockRate(Chip_Clock_GetMainClockRate(), false);
+		// cycle counter for the ring buffer statistics
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 	}
 
 	uart = nullptr; // set default value before checking which UART to configure
@@ -94,6 +386,7 @@ LpcUart::LpcUart(const LpcUartConfig &cfg) {
 	if(cfg.pUART == LPC_USART0) {
 		if(u0) return; // already exists
 		else u0 = this;
+		index = 0;
 		tx = SWM_UART0_TXD_O;
 		rx = SWM_UART0_RXD_I;
 		rts = SWM_UART0_RTS_O;
@@ -103,6 +396,7 @@ LpcUart::LpcUart(const LpcUartConfig &cfg) {
 	else if(cfg.pUART == LPC_USART1) {
 		if(u1) return; // already exists
 		else u1 = this;
+		index = 1;
 		tx = SWM_UART1_TXD_O;
 		rx = SWM_UART1_RXD_I;
 		rts = SWM_UART1_RTS_O;
@@ -112,6 +406,7 @@ LpcUart::LpcUart(const LpcUartConfig &cfg) {
 	else if(cfg.pUART == LPC_USART2) {
 		if(u2) return; // already exists
 		else u2 = this;
+		index = 2;
 		tx = SWM_UART2_TXD_O;
 		rx = SWM_UART2_RXD_I;
 		use_rts = false; // UART2 does not support handshakes
@@ -148,6 +443,14 @@ LpcUart::LpcUart(const LpcUartConfig &cfg) {
 	notify_rx = nullptr;
 	notify_tx = nullptr;
 	on_receive = nullptr;
+	rx_hook = nullptr;
+	rx_hook_arg = nullptr;
+	error_cb = nullptr;
+	error_cb_arg = nullptr;
+	dma_tx = cfg.dma_tx;
+	dma_rx = cfg.dma_rx;
+	dma_tx_len = 0;
+	dma_rx_halves = 0;
 	/* Setup UART */
 	Chip_UART_Init(uart);
 	Chip_UART_ConfigData(uart, cfg.data);
@@ -164,13 +467,29 @@ LpcUart::LpcUart(const LpcUartConfig &cfg) {
 
 	/* Before using the ring buffers, initialize them using the ring
 	   buffer init function */
-	RingBuffer_Init(&rxring, rxbuff, 1, UART_RB_SIZE);
-	RingBuffer_Init(&txring, txbuff, 1, UART_RB_SIZE);
-
+	own_rxbuff = (cfg.rx_buffer == nullptr);
+	own_txbuff = (cfg.tx_buffer == nullptr);
+	uint32_t rx_size = own_rxbuff || !cfg.rx_size ? UART_RB_SIZE : cfg.rx_size;
+	uint32_t tx_size = own_txbuff || !cfg.tx_size ? UART_RB_SIZE : cfg.tx_size;
+	// indices are masked with size - 1 and the DMA transfer count limits the size of a receive half
+	configASSERT((rx_size & (rx_size - 1)) == 0 && (tx_size & (tx_size - 1)) == 0);
+	configASSERT(!dma_rx || rx_size <= 2048);
+	rxbuff = own_rxbuff ? new uint8_t[rx_size] : cfg.rx_buffer;
+	txbuff = own_txbuff ? new uint8_t[tx_size] : cfg.tx_buffer;
+	rxring.init(rxbuff, rx_size);
+	txring.init(txbuff, tx_size);
+	reset_stats();
+	rx_break = false;
+
+
+	if(dma_tx || dma_rx) dma_setup();
 
 	/* Enable receive data and line status interrupt */
-	Chip_UART_IntEnable(uart, UART_INTEN_RXRDY);
+	if(!dma_rx) Chip_UART_IntEnable(uart, UART_INTEN_RXRDY);
 	Chip_UART_IntDisable(uart, UART_INTEN_TXRDY);	/* May not be needed */
+	Chip_UART_ClearStatus(uart, LPC_UART_ERRORS);
+	Chip_UART_IntEnable(uart, UART_INTEN_OVERRUN | UART_INTEN_DELTARXBRK | UART_INTEN_FRAMERR |
+			UART_INTEN_PARITYERR | UART_INTEN_RXNOISE);
 
 	NVIC_SetPriority(irqn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1);
 	/* Enable UART interrupt */
@@ -182,6 +501,10 @@ LpcUart::~LpcUart() {
 		NVIC_DisableIRQ(irqn);
 		Chip_UART_IntDisable(uart, UART_INTEN_RXRDY);
 		Chip_UART_IntDisable(uart, UART_INTEN_TXRDY);
+		Chip_UART_IntDisable(uart, UART_INTEN_OVERRUN | UART_INTEN_DELTARXBRK | UART_INTEN_FRAMERR |
+				UART_INTEN_PARITYERR | UART_INTEN_RXNOISE);
+		if(dma_tx) Chip_DMA_DisableChannel(LPC_DMA, dma_tx_ch);
+		if(dma_rx) Chip_DMA_DisableChannel(LPC_DMA, dma_rx_ch);
 
 		if(uart == LPC_USART0) {
 			u0 = nullptr;
@@ -192,6 +515,8 @@ LpcUart::~LpcUart() {
 		else if(uart == LPC_USART2) {
 			u2 = nullptr;
 		}
+		if(own_rxbuff) delete [] rxbuff;
+		if(own_txbuff) delete [] txbuff;
 	}
 }
 
@@ -200,19 +525,39 @@ void LpcUart::set_on_receive(void(*cb)(void))
 	on_receive = cb;
 }
 
+bool LpcUart::set_rx_hook(void (*hook)(void *arg, uint8_t c, portBASE_TYPE *hpw), void *arg)
+{
+	// DMA takes the characters before the hook could see them
+	if(dma_rx) return false;
+	// keep the ISR from seeing a half updated hook
+	Chip_UART_IntDisable(uart, UART_INTEN_RXRDY);
+	rx_hook_arg = arg;
+	rx_hook = hook;
+	Chip_UART_IntEnable(uart, UART_INTEN_RXRDY);
+	return true;
+}
+
+void LpcUart::set_error_callback(void (*cb)(void *arg, uint32_t errors, portBASE_TYPE *hpw), void *arg)
+{
+	// keep the ISR from seeing a half updated callback
+	NVIC_DisableIRQ(irqn);
+	error_cb_arg = arg;
+	error_cb = cb;
+	NVIC_EnableIRQ(irqn);
+}
+
 
 int  LpcUart::free()
 {
-	std::lock_guard<Fmutex> lock(write_mutex);
-
-	return UART_RB_SIZE - RingBuffer_GetCount(&txring);
+	return txring.space();
 }
 
 int  LpcUart::peek()
 {
-	std::lock_guard<Fmutex> lock(read_mutex);
-
-	return RingBuffer_GetCount(&rxring);
+	if(dma_rx) dma_rx_sync();
+	// the overwritten characters are skipped on the next read
+	uint32_t count = rxring.count();
+	return count > rxring.size() ? rxring.size() : count;
 }
 
 int  LpcUart::read(char &c)
@@ -224,36 +569,77 @@ int  LpcUart::read(char *buffer, int len)
 {
 	std::lock_guard<Fmutex> lock(read_mutex);
 
-	if(RingBuffer_GetCount(&rxring) <= 0) {
+	if(dma_rx) dma_rx_sync();
+	if(rxring.empty()) {
 		notify_rx = xTaskGetCurrentTaskHandle();
-		while(RingBuffer_GetCount(&rxring) <= 0) {
-			ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+		while(rxring.empty()) {
+			wait_rx(portMAX_DELAY);
 		}
 		notify_rx = nullptr;
 	}
 
-	return Chip_UART_ReadRB(uart, &rxring, buffer, len);
+	return rx_get((uint8_t *) buffer, len);
 }
 
 
 int  LpcUart::read(char *buffer, int len, TickType_t total_timeout, TickType_t ic_timeout)
 {
 	std::lock_guard<Fmutex> lock(read_mutex);
-
-	// we can't read more than ring buffer size at a time
-	if(len > UART_RB_SIZE) len = UART_RB_SIZE;
+	int count = 0;
 
 	TimeOut_t timeoutState;
 	vTaskSetTimeOutState(&timeoutState);
 
 	notify_rx = xTaskGetCurrentTaskHandle();
-	while(RingBuffer_GetCount(&rxring) < len && xTaskCheckForTimeOut(&timeoutState, &total_timeout) == pdFALSE) {
+	if(dma_rx) dma_rx_sync();
+	// take the data as it arrives so that the request may be longer than the ring buffer
+	count += rx_get((uint8_t *) buffer, len);
+	while(count < len && xTaskCheckForTimeOut(&timeoutState, &total_timeout) == pdFALSE) {
 		TickType_t timeout = total_timeout > ic_timeout ? ic_timeout : total_timeout;
-		 if(ulTaskNotifyTake( pdTRUE, timeout ) == 0) break;
+		bool received = wait_rx(timeout);
+		count += rx_get((uint8_t *) buffer + count, len - count);
+		if(!received) break;
 	}
 	notify_rx = nullptr;
 
-	return Chip_UART_ReadRB(uart, &rxring, buffer, len);;
+	return count;
+}
+
+int  LpcUart::read_frame(char *buffer, int len, TickType_t deadline, TickType_t ic_timeout)
+{
+	std::lock_guard<Fmutex> lock(read_mutex);
+	int count = 0;
+
+	notify_rx = xTaskGetCurrentTaskHandle();
+	if(dma_rx) dma_rx_sync();
+	for(;;) {
+		count += rx_get((uint8_t *) buffer + count, len - count);
+		if(count >= len) break;
+
+		TickType_t left = deadline - xTaskGetTickCount();
+		if((int32_t) left <= 0) break;
+		// after the first character the frame ends with silence
+		if(count > 0 && left > ic_timeout) left = ic_timeout;
+		if(!wait_rx(left) && count > 0) {
+			count += rx_get((uint8_t *) buffer + count, len - count);
+			break;
+		}
+	}
+	notify_rx = nullptr;
+
+	return count;
+}
+
+bool LpcUart::wait(TickType_t timeout)
+{
+	std::lock_guard<Fmutex> lock(read_mutex);
+
+	notify_rx = xTaskGetCurrentTaskHandle();
+	if(dma_rx) dma_rx_sync();
+	if(rxring.empty()) wait_rx(timeout);
+	notify_rx = nullptr;
+
+	return !rxring.empty();
 }
 
 int LpcUart::write(char c)
@@ -267,36 +653,73 @@ int LpcUart::write(const char *s)
 }
 
 int LpcUart::write(const char *buffer, int len)
+{
+	LpcUartSegment seg = { buffer, len };
+	return writev(&seg, 1);
+}
+
+int LpcUart::writev(const LpcUartSegment *seg, int count)
 {
 	std::lock_guard<Fmutex> lock(write_mutex);
 
-	int pos = 0;
+	int total = 0;
 	notify_tx = xTaskGetCurrentTaskHandle();
 
-	while(len > pos) {
-		// restrict single write to ring buffer size
-		int size = (len - pos) > UART_RB_SIZE ? UART_RB_SIZE : (len - pos);
-
-		// wait until we have space in the ring buffer
-		while(UART_RB_SIZE - RingBuffer_GetCount(&txring) < size) {
-			ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+	for(int i = 0; i < count; ++i) {
+		int pos = 0;
+		while(seg[i].len > pos) {
+			pos += txring.put((const uint8_t *) seg[i].data + pos, seg[i].len - pos);
+			if(seg[i].len > pos) {
+				// ring buffer is full: send what we have and wait until there is space
+				tx_start();
+				ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+			}
 		}
-		pos += Chip_UART_SendRB(uart, &txring, buffer+pos, size);
+		total += pos;
 	}
+	tx_start();
 	notify_tx = nullptr;
 
-	return pos;
+	return total;
+}
+
+/* Start sending the contents of the transmit ring buffer. Called with the write mutex held */
+void LpcUart::tx_start()
+{
+	uint32_t count = txring.count();
+	if(count > tx_high) tx_high = count;
+	if(dma_tx) {
+		taskENTER_CRITICAL();
+		dma_tx_start();
+		taskEXIT_CRITICAL();
+	}
+	else {
+		// ISR sends the data and disables the interrupt when the ring buffer is empty
+		Chip_UART_IntEnable(uart, UART_INTEN_TXRDY);
+	}
 }
 
 void LpcUart::txbreak(bool brk)
 {
-	// break handling not implemented yet
+	std::lock_guard<Fmutex> lockw(write_mutex);
+
+	if(brk) {
+		// break must not cut the last character short
+		while(!txring.empty() || !(Chip_UART_GetStatus(uart) & UART_STAT_TXIDLE)) {
+			vTaskDelay(1);
+		}
+		uart->CTRL |= UART_CTRL_TXBRKEN;
+	}
+	else {
+		uart->CTRL &= ~UART_CTRL_TXBRKEN;
+	}
 }
 
 bool LpcUart::rxbreak()
 {
-	// break handling not implemented yet
-	return false;
+	bool brk = rx_break || (Chip_UART_GetStatus(uart) & UART_STAT_RXBRK);
+	rx_break = false;
+	return brk;
 }
 
 void LpcUart::speed(int bps)
@@ -307,9 +730,65 @@ void LpcUart::speed(int bps)
 	Chip_UART_SetBaud(uart, bps);
 }
 
+void LpcUart::format(uint32_t data)
+{
+	std::lock_guard<Fmutex> lockw(write_mutex);
+	std::lock_guard<Fmutex> lockr(read_mutex);
+
+	// let the last character go out before changing the frame format
+	while(!txring.empty() || !(Chip_UART_GetStatus(uart) & UART_STAT_TXIDLE)) {
+		vTaskDelay(1);
+	}
+	Chip_UART_Disable(uart);
+	Chip_UART_ConfigData(uart, data);
+	Chip_UART_Enable(uart);
+}
+
+void LpcUart::rs485(bool turnaround, bool active_high)
+{
+	std::lock_guard<Fmutex> lockw(write_mutex);
+
+	if(!(uart->CFG & (1 << 20))) return; // rs485 mode is not enabled
+
+	uint32_t cfg = uart->CFG & ~((1 << 18) | (1 << 21));
+	if(turnaround) cfg |= (1 << 18); // OE turnaround time: driver stays on for one character time after the stop bit
+	if(active_high) cfg |= (1 << 21); // driver enable polarity
+	Chip_UART_Disable(uart);
+	uart->CFG = cfg;
+	Chip_UART_Enable(uart);
+}
+
 bool LpcUart::txempty()
 {
-	std::lock_guard<Fmutex> lock(write_mutex);
+	return txring.empty();
+}
+
+LpcUartStats LpcUart::stats() const
+{
+	LpcUartStats s = { rx_overflow, rx_high, tx_high, err_framing, err_parity, err_noise, err_overrun, err_breaks,
+			isr_cycles, isr_chars, wake_max, wake_sum, wake_count };
+	return s;
+}
 
-	return (RingBuffer_GetCount(&txring) == 0);
+void LpcUart::reset_stats()
+{
+	rx_overflow = 0;
+	rx_high = 0;
+	tx_high = 0;
+	err_framing = 0;
+	err_parity = 0;
+	err_noise = 0;
+	err_overrun = 0;
+	err_breaks = 0;
+	isr_cycles = 0;
+	isr_chars = 0;
+	wake_stamp = 0;
+	wake_max = 0;
+	wake_sum = 0;
+	wake_count = 0;
+}
+
+void LpcUart::rx_level(uint32_t count)
+{
+	if(count > rx_high) rx_high = count;
 }
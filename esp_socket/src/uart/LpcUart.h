@@ -13,6 +13,7 @@
 #include "task.h"
 #include "semphr.h"
 #include "Fmutex.h"
+#include "SpscRing.h"
 
 struct LpcPinMap {
 	int port; /* set to -1 to indicate unused pin */
@@ -28,43 +29,138 @@ struct LpcUartConfig {
 	LpcPinMap rx;
 	LpcPinMap rts; /* used as output enable if RS-485 mode is enabled */
 	LpcPinMap cts;
+	bool dma_tx; /* transmit with DMA instead of a TXRDY interrupt per character */
+	bool dma_rx; /* receive with DMA into the ring buffer. Receive hooks are not available in this mode */
+	/* Ring buffer storage. Sizes must be powers of two, with DMA receive at most 2048.
+	 * If a buffer is not given a buffer of the default size is allocated from the heap */
+	uint8_t *rx_buffer;
+	uint32_t rx_size;
+	uint8_t *tx_buffer;
+	uint32_t tx_size;
 };
 
+/* Part of a message for LpcUart::writev() */
+struct LpcUartSegment {
+	const char *data;
+	int len;
+};
+
+/* Ring buffer and line statistics for sizing the buffers to the traffic and monitoring the line */
+struct LpcUartStats {
+	uint32_t rx_overflow; /* received characters lost because the receive buffer was full */
+	uint32_t rx_high;     /* most characters in the receive buffer */
+	uint32_t tx_high;     /* most characters in the transmit buffer */
+	uint32_t framing;     /* characters with a missing stop bit */
+	uint32_t parity;      /* characters with a parity error */
+	uint32_t noise;       /* characters with conflicting samples of a bit */
+	uint32_t overrun;     /* characters lost because the receiver was not read in time */
+	uint32_t breaks;      /* break conditions received */
+	/* Ring buffer performance measured with the DWT cycle counter */
+	uint32_t isr_cycles;  /* cycles spent in the UART interrupt */
+	uint32_t isr_chars;   /* characters moved through the rings by the interrupt: isr_cycles / isr_chars is the cost per character */
+	uint32_t wake_max;    /* most cycles from the receive interrupt to the waiting reader running */
+	uint32_t wake_sum;    /* wake_sum / wake_count is the average receive latency in cycles */
+	uint32_t wake_count;
+};
+
+/* Line errors reported to the error callback. Same bits as in the UART status register */
+static const uint32_t LPC_UART_ERRORS = UART_STAT_OVERRUNINT | UART_STAT_DELTARXBRK | UART_STAT_FRM_ERRINT |
+		UART_STAT_PAR_ERRINT | UART_STAT_RXNOISEINT;
+
 
 class LpcUart {
 public:
 	LpcUart(const LpcUartConfig &cfg);
 	LpcUart(const LpcUart &) = delete;
 	virtual ~LpcUart();
+	/* free(), peek() and txempty() don't lock: the ring buffers are lock-free between the ISR and
+	 * the tasks. Reads and writes are serialized with mutexes so that several tasks can use the port. */
 	int  free(); /* get amount of free space in transmit buffer */
 	int  peek(); /* get number of received characters in receive buffer */
 	int  write(char c);
 	int  write(const char *s);
 	int  write(const char *buffer, int len);
+	/* Write the segments as one message: writes from other tasks can't come in between and
+	 * transmission is started once for the whole message unless it does not fit in the buffer */
+	int  writev(const LpcUartSegment *seg, int count);
 	int  read(char &c); /* get a single character. Returns number of characters read --> returns 0 if no character is available */
 	int  read(char *buffer, int len);
 	int  read(char *buffer, int len, TickType_t total_timeout, TickType_t ic_timeout = portMAX_DELAY);
-	void txbreak(bool brk); /* set break signal on */
-	bool rxbreak(); /* check if break is received */
+	/* Read a frame: wait for the first character until the deadline (tick count) and return when the
+	 * line has been quiet for ic_timeout ticks after a character, len characters have been read or
+	 * the deadline passes. Returns the number of characters read */
+	int  read_frame(char *buffer, int len, TickType_t deadline, TickType_t ic_timeout);
+	/* Sleep until received characters are available or the timeout expires. A task notification
+	 * to the calling task also ends the wait. Returns true if characters are available */
+	bool wait(TickType_t timeout);
+	void txbreak(bool brk); /* set break signal on or off. Waits for transmit buffer to empty before turning it on */
+	bool rxbreak(); /* check if break is received. Returns true if break is on or has been received since the last call */
 	void speed(int bps); /* change transmission speed */
+	void format(uint32_t data); /* change data length, parity and stop bits (UART_CFG_xxx) */
+	void rs485(bool turnaround, bool active_high); /* driver enable turnaround and polarity in RS-485 mode */
 	bool txempty();
+	LpcUartStats stats() const;
+	void reset_stats();
 	void set_on_receive(void(*cb)(void));
+	/* While a receive hook is installed, received characters are passed to the hook in ISR context
+	 * instead of being stored in the receive buffer. Set hook to nullptr to restore buffering.
+	 * Returns false if the port receives with DMA: characters never pass the ISR then */
+	bool set_rx_hook(void (*hook)(void *arg, uint8_t c, portBASE_TYPE *hpw), void *arg);
+	/* Error callback is called in ISR context with the line errors (LPC_UART_ERRORS bits) that occurred */
+	void set_error_callback(void (*cb)(void *arg, uint32_t errors, portBASE_TYPE *hpw), void *arg);
 
 	void isr(portBASE_TYPE *hpw); /* ISR handler. This will be called by the HW ISR handler. Do not call from application */
+	void dma_isr(portBASE_TYPE *hpw); /* DMA ISR handler. This will be called by the DMA ISR handler. Do not call from application */
 private:
+	void dma_setup();
+	void dma_tx_start();
+	void tx_start();
+	void dma_rx_sync();
+	int rx_get(uint8_t *buffer, int len);
+	bool wait_rx(TickType_t timeout);
 	LPC_USART_T *uart;
 	IRQn_Type irqn;
-	/* currently we support only fixed size ring buffers */
-	static const int UART_RB_SIZE = 128;
-	/* Transmit and receive ring buffers */
-	RINGBUFF_T txring;
-	RINGBUFF_T rxring;
-	uint8_t rxbuff[UART_RB_SIZE];
-	uint8_t txbuff[UART_RB_SIZE];
+	static const uint32_t UART_RB_SIZE = 128; /* default ring buffer size */
+	void rx_level(uint32_t count); /* update receive high water mark */
+	/* Transmit and receive ring buffers. The ISR (or DMA) is the producer of rxring and the consumer of txring */
+	SpscRing txring;
+	SpscRing rxring;
+	uint8_t *rxbuff;
+	uint8_t *txbuff;
+	bool own_rxbuff; // buffer was allocated by us
+	bool own_txbuff;
+	volatile uint32_t rx_overflow;
+	volatile uint32_t rx_high;
+	volatile uint32_t tx_high;
+	volatile uint32_t err_framing;
+	volatile uint32_t err_parity;
+	volatile uint32_t err_noise;
+	volatile uint32_t err_overrun;
+	volatile uint32_t err_breaks;
+	volatile bool rx_break; // break received since the last rxbreak()
+	volatile uint32_t isr_cycles;
+	volatile uint32_t isr_chars;
+	volatile uint32_t wake_stamp; // cycle count when the reader was notified of received data, zero if none
+	volatile uint32_t wake_max;
+	volatile uint32_t wake_sum;
+	volatile uint32_t wake_count;
+	void wake_latency(); /* reader has woken up */
+	void line_errors(uint32_t stat, portBASE_TYPE *hpw);
 	static bool init; /* set when first UART is initialized. We have a global clock setting for all UARTSs */
 	TaskHandle_t notify_rx;
 	TaskHandle_t notify_tx;
 	void (*on_receive)(void); // callback for received data notifications
+	void (* volatile rx_hook)(void *arg, uint8_t c, portBASE_TYPE *hpw); // per character receive hook
+	void *rx_hook_arg;
+	void (* volatile error_cb)(void *arg, uint32_t errors, portBASE_TYPE *hpw); // line error callback
+	void *error_cb_arg;
+	int index; // UART number, selects the DMA channels and descriptors
+	bool dma_tx;
+	bool dma_rx;
+	DMA_CHID_T dma_tx_ch;
+	DMA_CHID_T dma_rx_ch;
+	volatile uint32_t dma_tx_len; // number of characters in the transfer in progress, zero when idle
+	volatile uint32_t dma_rx_halves; // number of completed receive buffer halves
 	Fmutex read_mutex;
 	Fmutex write_mutex;
 };
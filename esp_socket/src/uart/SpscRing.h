@@ -0,0 +1,95 @@
+/*
+ * SpscRing.h
+ *
+ *  Created on: 18.10.2026
+ *
+ *  Single producer / single consumer byte ring buffer for passing data between
+ *  an interrupt handler and a task without locks. The producer only writes the
+ *  head and the consumer only writes the tail. Data is published with a release
+ *  store of the index and picked up with an acquire load of the other side's
+ *  index so the buffer contents are always visible before the index update.
+ *
+ *  Indices run freely and are masked on access, so the buffer size must be a
+ *  power of two. The count is head - tail, which also works after wrap around.
+ *  If more than one task produces (or consumes) the task side must serialize
+ *  its accesses, e.g. with a mutex.
+ */
+
+#ifndef SPSCRING_H_
+#define SPSCRING_H_
+
+#include <stdint.h>
+#include <atomic>
+#include "FreeRTOS.h"
+
+class SpscRing {
+public:
+	SpscRing(uint8_t *buffer = nullptr, uint32_t size = 0) : buf(buffer), len(size), head(0), tail(0) {}
+	SpscRing(const SpscRing &) = delete;
+
+	void init(uint8_t *buffer, uint32_t size) { /* size must be a power of two */
+		configASSERT((size & (size - 1)) == 0); // other sizes would corrupt data when the indices are masked
+		buf = buffer;
+		len = size;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	uint32_t size() const { return len; }
+	uint32_t count() const { /* safe from either side */
+		uint32_t t = tail.load(std::memory_order_acquire);
+		return head.load(std::memory_order_acquire) - t;
+	}
+	uint32_t space() const { return len - count(); }
+	bool empty() const { return count() == 0; }
+
+	/* producer side */
+	bool put(uint8_t c) {
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if(h - tail.load(std::memory_order_acquire) >= len) return false;
+		buf[h & (len - 1)] = c;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+	uint32_t put(const uint8_t *data, uint32_t n) { /* returns number of bytes stored */
+		uint32_t h = head.load(std::memory_order_relaxed);
+		uint32_t free = len - (h - tail.load(std::memory_order_acquire));
+		if(n > free) n = free;
+		for(uint32_t i = 0; i < n; ++i) buf[(h + i) & (len - 1)] = data[i];
+		head.store(h + n, std::memory_order_release);
+		return n;
+	}
+
+	/* consumer side */
+	bool get(uint8_t &c) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if(head.load(std::memory_order_acquire) == t) return false;
+		c = buf[t & (len - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	uint32_t get(uint8_t *data, uint32_t n) { /* returns number of bytes taken */
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		uint32_t avail = head.load(std::memory_order_acquire) - t;
+		if(n > avail) n = avail;
+		for(uint32_t i = 0; i < n; ++i) data[i] = buf[(t + i) & (len - 1)];
+		tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+
+	/* Raw index access for a DMA controller that acts as the producer or the consumer.
+	 * Indices are free running; mask them with size() - 1 to get a buffer position. */
+	uint8_t *data() const { return buf; }
+	uint32_t head_index() const { return head.load(std::memory_order_acquire); }
+	uint32_t tail_index() const { return tail.load(std::memory_order_acquire); }
+	void set_head(uint32_t h) { head.store(h, std::memory_order_release); }
+	void set_tail(uint32_t t) { tail.store(t, std::memory_order_release); }
+
+private:
+	uint8_t *buf;
+	uint32_t len;
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+};
+
+#endif /* SPSCRING_H_ */
@@ -5,6 +5,7 @@
  *      Author: keijo
  */
 
+#include <cstring>
 #include "LpcUart.h"
 
 static LpcUart *dbgu;
@@ -35,14 +36,18 @@ int __sys_write(int iFileHandle, char *pcBuffer, int iLength) {
 int _write(int iFileHandle, char *pcBuffer, int iLength) {
 #endif
 	if(dbgu) {
-		int len = iLength;
-		while(len > 0) {
-			if(*pcBuffer == '\n') { // send a CR before every LF
-				while(dbgu->write('\r')==0);
+		// send the text between line feeds in one piece with a CR before every LF
+		const char *p = pcBuffer;
+		const char *end = pcBuffer + iLength;
+		while(p < end) {
+			const char *lf = (const char *) memchr(p, '\n', end - p);
+			if(lf == nullptr) {
+				dbgu->write(p, end - p);
+				break;
 			}
-			while(dbgu->write(*pcBuffer)==0);
-			++pcBuffer;
-			--len;
+			LpcUartSegment seg[] = { { p, (int) (lf - p) }, { "\r\n", 2 } };
+			dbgu->writev(seg, 2);
+			p = lf + 1;
 		}
 	}
 	// Function returns number of bytes written